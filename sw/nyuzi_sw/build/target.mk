@@ -37,6 +37,7 @@ VERILATOR=$(BINDIR)/verilator_model
 VCSRUN=$(BUILDDIR)/vcsrun.pl
 SERIAL_BOOT=$(BINDIR)/serial_boot
 MKFS=$(BINDIR)/mkfs
+MAKE_RESOURCE=$(BINDIR)/make_resource
 CRT0_BARE=$(TOPDIR)/software/libs/libos/crt0-bare.o
 CRT0_KERN=$(TOPDIR)/software/libs/libos/crt0-kern.o
 
@@ -11,9 +11,25 @@
 // Offset for distance to object from the camera
 #define CAMERA_DISTANCE_OFFSET 6
 
-float getFloatIndex(const void *ptr, unsigned int index) {
-    return *((float *)(ptr) + index);
-}
+// Blend between the two nearest mip levels. This hides the seams between
+// levels, but reads twice as many texels, so it is off by default.
+// #define TRILINEAR_FILTERING
+
+// Vertex attribute formats: position, texture coordinate, normal. These
+// must match make_resource_file.py.
+static const AttribFormat kFloatFormats[] = {
+    kAttribFloat32, kAttribFloat32, kAttribFloat32,
+    kAttribFloat32, kAttribFloat32,
+    kAttribFloat32, kAttribFloat32, kAttribFloat32
+};
+static const AttribFormat kQuantizedFormats[] = {
+    kAttribFloat32, kAttribFloat32, kAttribFloat32,
+    kAttribFloat16, kAttribFloat16,
+    kAttribSnorm16, kAttribSnorm16, kAttribSnorm16
+};
+
+// Size of a quantized vertex, padded to a multiple of four bytes
+static const int kQuantizedStride = 24;
 
 /**
  * @brief       The default constructor which initializes member variables
@@ -53,13 +69,34 @@ void SceneView::start() {
     for (unsigned int textureIndex = 0; textureIndex < resource_header->numTextures; textureIndex++) {
         textures[textureIndex] = new Texture();
         textures[textureIndex]->enableBilinearFiltering(true);
+#ifdef TRILINEAR_FILTERING
+        textures[textureIndex]->enableTrilinearFiltering(true);
+#endif
         int offset = texture_header[textureIndex].offset;
+        SurfaceFormat format = static_cast<SurfaceFormat>(texture_header[textureIndex].format);
         for (unsigned int mipLevel = 0; mipLevel < texture_header[textureIndex].mipLevels; mipLevel++) {
             int width = texture_header[textureIndex].width >> mipLevel;
             int height = texture_header[textureIndex].height >> mipLevel;
-            Surface *surface = new Surface(width, height, resource_file + offset);
+            Surface *surface;
+            if (format == kRGBA8888 && (width % 4) == 0 && (height % 4) == 0) {
+                // Convert to a tiled layout, which is more cache friendly
+                surface = new Surface(width, height, kRGBA8888Tiled);
+                surface->loadPixels(resource_file + offset);
+                offset += width * height * 4;
+            }
+            else if (format == kRGBA8888Tiled && ((unsigned int)(resource_file + offset) & 63) != 0) {
+                // Already tiled, but each block is read with a vector load, which
+                // must be aligned to a cache line. Copy it.
+                surface = new Surface(width, height, kRGBA8888Tiled);
+                memcpy(surface->bits(), resource_file + offset, width * height * 4);
+                offset += width * height * 4;
+            }
+            else {
+                surface = new Surface(width, height, resource_file + offset, format);
+                offset += surface->getStride() * (format == kRGBA8888 ? height : height / 4);
+            }
+
             textures[textureIndex]->setMipSurface(mipLevel, surface);
-            offset += width * height * 4;
         }
     }
 
@@ -69,35 +106,32 @@ void SceneView::start() {
 
     for (unsigned int meshIndex = 0; meshIndex < resource_header->numMeshes; meshIndex++) {
         const MeshEntry &entry = mesh_header[meshIndex];
-        vertexBuffers[meshIndex].setData(resource_file + entry.offset,
-                                            entry.numVertices, sizeof(float) * kAttrsPerVertex);
-
-        // Iterate over alle vertices in mesh to find lowest and highest x,y,z
-        for (unsigned int i = 0; i < entry.numVertices; i++) {
-            float x = getFloatIndex(vertexBuffers[meshIndex].getData(), 8*i + 0);
-            float y = getFloatIndex(vertexBuffers[meshIndex].getData(), 8*i + 1);
-            float z = getFloatIndex(vertexBuffers[meshIndex].getData(), 8*i + 2);
-            if (x < fXmin) {
-                fXmin = x;
-            }
-            if (x > fXmax) {
-                fXmax = x;
-            }
-            if (y < fYmin) {
-                fYmin = y;
-            }
-            if (y > fYmax) {
-                fYmax = y;
-            }
-            if (z < fZmin) {
-                fZmin = z;
-            }
-            if (z > fZmax) {
-                fZmax = z;
-            }
+        const AttribFormat *formats = (entry.flags & MESH_QUANTIZED) ? kQuantizedFormats
+                                      : kFloatFormats;
+        if (resource_header->flags & FILE_PLANAR_VERTICES) {
+            vertexBuffers[meshIndex].setPlanarData(resource_file + entry.offset,
+                                                   entry.numVertices, formats, kAttrsPerVertex);
+        }
+        else {
+            vertexBuffers[meshIndex].setData(resource_file + entry.offset, entry.numVertices,
+                                             (entry.flags & MESH_QUANTIZED) ? kQuantizedStride
+                                             : kAttrsPerVertex * sizeof(float),
+                                             formats, kAttrsPerVertex);
         }
-        indexBuffers[meshIndex].setData(resource_file + entry.offset + entry.numVertices
-                            * kAttrsPerVertex * sizeof(float), entry.numIndices, sizeof(int));
+
+        // The resource file has the bounds of each mesh. Combine them to
+        // find the lowest and highest x,y,z of the scene.
+        fXmin = min(fXmin, entry.boundsMin[0]);
+        fYmin = min(fYmin, entry.boundsMin[1]);
+        fZmin = min(fZmin, entry.boundsMin[2]);
+        fXmax = max(fXmax, entry.boundsMax[0]);
+        fYmax = max(fYmax, entry.boundsMax[1]);
+        fZmax = max(fZmax, entry.boundsMax[2]);
+
+        indexBuffers[meshIndex].setData(resource_file + entry.offset
+                                        + vertexBuffers[meshIndex].getSize(), entry.numIndices,
+                                        (entry.flags & MESH_INDEX16) ? sizeof(uint16_t)
+                                        : sizeof(uint32_t));
     }
 
     // Set the camera position and viewing direction
@@ -109,9 +143,9 @@ void SceneView::start() {
     pFrameBuffer3 = (uint32_t *) (FB_BASE3);    
     
     // Creeate the render target and bind it to the first framebuffer
-    context      = new RenderContext(0x1000000); // TODO describe this address
+    context      = new RenderContext();
     renderTarget = new RenderTarget();
-    depthBuffer  = new Surface(FB_WIDTH, FB_HEIGHT);
+    depthBuffer  = new Surface(FB_WIDTH, FB_HEIGHT, kR16);
     colorBuffer1 = new Surface(FB_WIDTH, FB_HEIGHT, pFrameBuffer1);
     colorBuffer2 = new Surface(FB_WIDTH, FB_HEIGHT, pFrameBuffer2);
     colorBuffer3 = new Surface(FB_WIDTH, FB_HEIGHT, pFrameBuffer3);
@@ -120,8 +154,24 @@ void SceneView::start() {
     renderTarget->setDepthBuffer(depthBuffer);
     context->bindTarget(renderTarget);
     context->enableDepthBuffer(true);
+    // The scene is opaque and has a lot of overdraw, so only shade visible pixels
+    context->enableDepthPrepass(true);
     context->bindShader(new TextureShader());
     context->setClearColor(0.52, 0.80, 0.98);
+
+    // The uniforms only change when the camera moves, so they are kept in
+    // buffers that persist across frames rather than copied for each mesh.
+    texturedUniforms = new UniformBuffer(sizeof(TextureUniforms));
+    untexturedUniforms = new UniformBuffer(sizeof(TextureUniforms));
+}
+
+/**
+ * @brief       Count cache misses in each rendering phase, for printStats
+ */
+void SceneView::enablePerfCounterStats() {
+    set_perf_counter_event(0, PERF_DCACHE_MISS);
+    set_perf_counter_event(1, PERF_L2_MISS);
+    context->enablePerfCounterStats(true);
 }
 
 /**
@@ -140,9 +190,16 @@ char *SceneView::readResourceFile() {
  * @return      The required time to render the frame
  */
 uint64_t SceneView::render() {
-    modelViewMatrix = Matrix::lookAt(lookAtArgs.vLocation, lookAtArgs.vLookAt, lookAtArgs.vUp);
-    uniforms.fMVPMatrix = projectionMatrix * modelViewMatrix;
-    uniforms.fNormalMatrix = modelViewMatrix.upper3x3();
+    if (bCameraChanged) {
+        modelViewMatrix = Matrix::lookAt(lookAtArgs.vLocation, lookAtArgs.vLookAt, lookAtArgs.vUp);
+        uniforms.fMVPMatrix = projectionMatrix * modelViewMatrix;
+        uniforms.fNormalMatrix = modelViewMatrix.upper3x3();
+        uniforms.fHasTexture = true;
+        texturedUniforms->update(&uniforms);
+        uniforms.fHasTexture = false;
+        untexturedUniforms->update(&uniforms);
+        bCameraChanged = false;
+    }
     
     if (eCurrentRenderFB == FB_1) {
         switch_fb(FB_1);
@@ -169,15 +226,17 @@ uint64_t SceneView::render() {
         if (entry.textureId != 0xffffffff) {
             assert(entry.textureId < resource_header->numTextures);
             context->bindTexture(0, textures[entry.textureId]);
-            uniforms.fHasTexture = true;
+            context->bindUniforms(texturedUniforms);
         }
         else {
-            uniforms.fHasTexture = false;
+            context->bindUniforms(untexturedUniforms);
         }
 
-        context->bindUniforms(&uniforms, sizeof(uniforms));
         context->bindVertexAttrs(&vertexBuffers[meshIndex]);
-        context->drawElements(&indexBuffers[meshIndex]);
+        // Skip meshes that are outside the view frustum
+        context->drawElements(&indexBuffers[meshIndex], uniforms.fMVPMatrix,
+                              Vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]),
+                              Vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]));
     }
 
     clock_t startTime = clock();
@@ -234,6 +293,7 @@ void SceneView::rotate(dir_t dir_horizontal, dir_t dir_vertical, float delta) {
     else {
         lookAtArgs.vUp = Vec3(0, -1, 0); 
     }
+    bCameraChanged = true;
 }
 
 /**
@@ -249,6 +309,7 @@ void SceneView::move(dir_t dir, float step_size) {
     else if (dir == DIR_DOWN) {
         lookAtArgs.vLocation = lookAtArgs.vLocation - lookAtArgs.vLookAt.normalized() * step_size;
     }
+    bCameraChanged = true;
 }
 
 /**
@@ -277,6 +338,7 @@ void SceneView::turn(dir_t dir, float angle) {
         CAMERA_DISTANCE_OFFSET,
         cos(this->fTheta)*1000
     );
+    bCameraChanged = true;
 }
 
 /**
@@ -290,4 +352,37 @@ void SceneView::resetCamera() {
     lookAtArgs.vLocation = Vec3(CAMERA_DISTANCE_OFFSET, CAMERA_DISTANCE_OFFSET, 0);
     lookAtArgs.vLookAt = Vec3(0,0,0);
     lookAtArgs.vUp = Vec3(0, 1, 0);
-}
\ No newline at end of file
+    bCameraChanged = true;
+}
+
+/**
+ * @brief       Print the render statistics of the last frame
+ */
+void SceneView::printStats() {
+    const RenderStats &stats = context->getStats();
+    printf("cycles: vertex %u setup %u fill %u\n\r", stats.phaseCycles[RenderStats::kVertexShading],
+           stats.phaseCycles[RenderStats::kTriangleSetup], stats.phaseCycles[RenderStats::kPixelFill]);
+    printf("draw calls: %d culled %d\n\r", stats.drawCalls, stats.drawCallsCulled);
+    printf("triangles: submitted %d culled %d clipped %d binned %d\n\r", stats.trianglesSubmitted,
+           stats.trianglesCulled, stats.trianglesClipped, stats.trianglesBinned);
+    printf("pixels: shaded %d depth rejected %d\n\r", stats.pixelsShaded, stats.pixelsDepthRejected);
+    for (int phase = 0; phase < RenderStats::kNumPhases; phase++) {
+        printf("phase %d: dcache misses %u l2 misses %u\n\r", phase,
+               stats.phasePerfCounters[phase][0], stats.phasePerfCounters[phase][1]);
+    }
+
+    // Find the most expensive tile
+    int slowestTile = 0;
+    for (int tile = 1; tile < stats.numTiles; tile++) {
+        if (stats.tileFillCycles[tile] > stats.tileFillCycles[slowestTile]) {
+            slowestTile = tile;
+        }
+    }
+    printf("slowest tile: %d (%d triangles, %u cycles)\n\r", slowestTile,
+           stats.tileTriangles[slowestTile], stats.tileFillCycles[slowestTile]);
+
+    const RegionAllocator::Stats &memStats = context->getWorkingMemoryStats();
+    printf("working memory: %u used, %u peak, %u reserved\n\r",
+           (uint32_t)memStats.lastFrameBytesUsed, (uint32_t)memStats.peakBytesUsed,
+           (uint32_t)memStats.bytesReserved);
+}
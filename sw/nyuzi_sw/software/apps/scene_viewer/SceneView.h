@@ -10,9 +10,11 @@
 #define __SCENE_VIEW_H
 
 #include <nyuzi.h>
+#include <performance_counters.h>
 #include <RenderContext.h>
 #include <schedule.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <vga.h>
 #include <Surface.h>
@@ -22,15 +24,24 @@
 #include "shared_mem_itf.h"
 #include <float.h>
 
+// Flags in FileHeader
+#define FILE_PLANAR_VERTICES 1  // Each vertex attribute is in a separate array
+
+// Flags in MeshEntry
+#define MESH_INDEX16 1          // Indices are 16 bits
+#define MESH_QUANTIZED 2        // Half float texture coordinates, signed normalized normals
+
 struct FileHeader {
     uint32_t fileSize;
     uint32_t numTextures;
     uint32_t numMeshes;
+    uint32_t flags;
 };
 
 struct TextureEntry {
     uint32_t offset;
-    uint32_t mipLevels;
+    uint16_t mipLevels;
+    uint16_t format;     // SurfaceFormat
     uint16_t width;
     uint16_t height;
 };
@@ -40,6 +51,9 @@ struct MeshEntry {
     uint32_t textureId;
     uint32_t numVertices;
     uint32_t numIndices;
+    float boundsMin[3];     // Axis aligned bounding box of the vertices
+    float boundsMax[3];
+    uint32_t flags;
 };
 
 struct LookAtArguments {
@@ -77,6 +91,8 @@ public:
     void move(dir_t dir, float step_size);
     void turn(dir_t dir, float angle);
     void resetCamera();
+    void enablePerfCounterStats();
+    void printStats();
     
 private:
     char *readResourceFile();   // TODO remove prefix for variables
@@ -102,6 +118,9 @@ private:
     Surface *colorBuffer3;
     Matrix projectionMatrix;
     TextureUniforms uniforms;
+    UniformBuffer *texturedUniforms;    // Copies of uniforms for meshes with
+    UniformBuffer *untexturedUniforms;  // and without a texture
+    bool bCameraChanged = true;         // The uniform buffers must be updated
     float fTheta;
     float fPsi;
     dir_t eRotateDirection;
@@ -109,9 +128,9 @@ private:
     float fXmin = FLT_MAX;
     float fYmin = FLT_MAX;
     float fZmin = FLT_MAX;
-    float fXmax = FLT_MIN;
-    float fYmax = FLT_MIN;
-    float fZmax = FLT_MIN;
+    float fXmax = -FLT_MAX;
+    float fYmax = -FLT_MAX;
+    float fZmax = -FLT_MAX;
     fb_t eCurrentRenderFB = FB_1;
 };
 
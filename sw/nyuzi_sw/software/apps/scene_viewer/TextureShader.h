@@ -17,8 +17,8 @@
 
 #pragma once
 
+#include <InlineShader.h>
 #include <Matrix.h>
-#include <Shader.h>
 #include <SIMDMath.h>
 #include <Texture.h>
 
@@ -34,13 +34,9 @@ struct TextureUniforms
     float fDirectional;
 };
 
-class TextureShader : public Shader
+class TextureShader : public InlineShader<TextureShader, 8, 9>
 {
 public:
-    TextureShader()
-        :	Shader(8, 9)
-    {
-    }
 
     void shadeVertices(vecf16_t *outParams, const vecf16_t *inAttribs, const void *_uniforms,
                        vmask_t) const override
@@ -20,18 +20,37 @@ Read a Wavefront .OBJ file and convert it into a flat file that can be read
 by the viewer program
 """
 
+import argparse
 import math
 import os
 import re
 import struct
 import subprocess
-import sys
 import tempfile
 
 NUM_MIP_LEVELS = 4
 
+# Must match SurfaceFormat in librender/Surface.h
+FORMAT_RGBA8888 = 0
+FORMAT_BC1 = 1
+FORMAT_BC3 = 2
+
+# Must match the flags in SceneView.h
+FILE_PLANAR_VERTICES = 1
+MESH_INDEX16 = 1
+MESH_QUANTIZED = 2
+
+# With --quantize, texture coordinates are stored as half floats if they
+# are all within this range, which keeps the error below 1/1024.
+HALF_FLOAT_UV_LIMIT = 2.0
+
+# Set from the command line
+compress_textures = False
+planar_vertices = False
+quantize = False
+
 # This is the final output of the parsing stage
-texture_list = []  # (width, height, data)
+texture_list = []  # (width, height, format, data)
 mesh_list = []		# (texture index, vertex list, index list)
 
 material_name_to_texture_idx = {}
@@ -90,17 +109,130 @@ def read_image_file(filename, resize_to_width=None, resize_to_height=None):
     return (width, height, texture_data)
 
 
+def pack_565(color):
+    return ((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3)
+
+
+def unpack_565(value):
+    red = (value >> 11) & 0x1f
+    green = (value >> 5) & 0x3f
+    blue = value & 0x1f
+    return ((red << 3) | (red >> 2), (green << 2) | (green >> 4),
+            (blue << 3) | (blue >> 2))
+
+
+def nearest_index(palette, value):
+    best_index = 0
+    best_error = None
+    for index, entry in enumerate(palette):
+        error = sum((a - b) * (a - b) for a, b in zip(entry, value))
+        if best_error is None or error < best_error:
+            best_index = index
+            best_error = error
+
+    return best_index
+
+
+def encode_color_block(texels):
+    """
+    Encode the RGB channels of 16 texels as a BC1 color block. The endpoints
+    are the corners of the bounding box of the colors. Always uses four color
+    mode (color0 > color1), which is required for the color half of BC3.
+    """
+    low = tuple(min(t[c] for t in texels) for c in range(3))
+    high = tuple(max(t[c] for t in texels) for c in range(3))
+    color0 = pack_565(high)
+    color1 = pack_565(low)
+    if color0 < color1:
+        color0, color1 = color1, color0
+
+    if color0 == color1:
+        # Solid block: all indices select color0
+        return struct.pack('<HHI', color0, color1, 0)
+
+    end0 = unpack_565(color0)
+    end1 = unpack_565(color1)
+    palette = [end0, end1,
+               tuple((2 * a + b) // 3 for a, b in zip(end0, end1)),
+               tuple((a + 2 * b) // 3 for a, b in zip(end0, end1))]
+    indices = 0
+    for texel_index, texel in enumerate(texels):
+        indices |= nearest_index(palette, texel[:3]) << (texel_index * 2)
+
+    return struct.pack('<HHI', color0, color1, indices)
+
+
+def encode_alpha_block(texels):
+    """Encode the alpha channel of 16 texels as a BC3 alpha block."""
+    alpha0 = max(t[3] for t in texels)
+    alpha1 = min(t[3] for t in texels)
+    if alpha0 == alpha1:
+        return struct.pack('<BB', alpha0, alpha1) + bytes(6)
+
+    # Eight alpha mode (alpha0 > alpha1)
+    palette = [(alpha0,), (alpha1,)]
+    for step in range(1, 7):
+        palette.append((((7 - step) * alpha0 + step * alpha1) // 7,))
+
+    indices = 0
+    for texel_index, texel in enumerate(texels):
+        indices |= nearest_index(palette, (texel[3],)) << (texel_index * 3)
+
+    return struct.pack('<BB', alpha0, alpha1) + indices.to_bytes(6, 'little')
+
+
+def compress_image(width, height, data, texture_format):
+    """
+    Convert RGBA data to a block compressed format. Blocks are 4x4 texels
+    and are stored in row major order.
+    """
+    output = bytearray()
+    for block_y in range(0, height, 4):
+        for block_x in range(0, width, 4):
+            texels = []
+            for y in range(block_y, block_y + 4):
+                for x in range(block_x, block_x + 4):
+                    offset = (y * width + x) * 4
+                    texels.append(tuple(data[offset:offset + 4]))
+
+            if texture_format == FORMAT_BC3:
+                output += encode_alpha_block(texels)
+
+            output += encode_color_block(texels)
+
+    return bytes(output)
+
+
 def read_texture(filename):
     print('read texture ' + filename)
-    width, height, data = read_image_file(filename)
+    width, height, base_data = read_image_file(filename)
+    levels = [(width, height, base_data)]
 
     # Read in lower mip levels
     for level in range(1, NUM_MIP_LEVELS + 1):
         _, _, sub_data = read_image_file(
             filename, width >> level, height >> level)
-        data += sub_data
+        levels.append((width >> level, height >> level, sub_data))
+
+    # Block formats need every mip level to be a whole number of blocks.
+    # Textures that need alpha use BC3, others BC1.
+    texture_format = FORMAT_RGBA8888
+    if compress_textures and all(level_width % 4 == 0 and level_height % 4 == 0
+                                 for level_width, level_height, _ in levels):
+        if any(alpha != 255 for alpha in base_data[3::4]):
+            texture_format = FORMAT_BC3
+        else:
+            texture_format = FORMAT_BC1
+
+    data = b''
+    for level_width, level_height, level_data in levels:
+        if texture_format == FORMAT_RGBA8888:
+            data += level_data
+        else:
+            data += compress_image(level_width, level_height, level_data,
+                                   texture_format)
 
-    return width, height, data
+    return width, height, texture_format, data
 
 
 def read_mtl_file(filename):
@@ -214,7 +346,7 @@ def read_obj_file(filename):
                 polygon_indices = []
                 for indices in parsed_indices:
                     vertex_attrs = vertex_positions[indices[0]]
-                    if len(indices) > 1 and indices[1]:
+                    if len(indices) > 1 and indices[1] != '':
                         vertex_attrs += texture_coordinates[indices[1]]
                     else:
                         vertex_attrs += (0, 0)
@@ -290,18 +422,52 @@ def align(addr, alignment):
     return int((addr + alignment - 1) // alignment) * alignment
 
 
+def mesh_bounds(vertices):
+    mins = [float('Inf')] * 3
+    maxs = [float('-Inf')] * 3
+    for vert in vertices:
+        for axis in range(3):
+            mins[axis] = min(mins[axis], vert[axis])
+            maxs[axis] = max(maxs[axis], vert[axis])
+
+    return mins + maxs
+
+
+def mesh_flags(vertices):
+    if not quantize:
+        return 0
+
+    flags = 0
+    if len(vertices) <= 0x10000:
+        flags |= MESH_INDEX16
+
+    if all(abs(val) <= HALF_FLOAT_UV_LIMIT for vert in vertices
+           for val in vert[3:5]):
+        flags |= MESH_QUANTIZED
+
+    return flags
+
+
+def pack_attrib(fmt, val):
+    if fmt == 'h':
+        # Signed normalized
+        return struct.pack('<h', int(round(max(-1.0, min(1.0, val)) * 32767)))
+
+    return struct.pack('<' + fmt, val)
+
+
 def write_resource_file(filename):
-    current_data_offset = 12 + len(texture_list) * \
-        12 + len(mesh_list) * 16  # Skip header
-    current_header_offset = 12
+    current_data_offset = 16 + len(texture_list) * \
+        12 + len(mesh_list) * 44  # Skip header
+    current_header_offset = 16
 
     with open(filename, 'wb') as f:
         # Write textures
-        for width, height, data in texture_list:
+        for width, height, texture_format, data in texture_list:
             # Write file header
             f.seek(current_header_offset)
-            f.write(struct.pack('iihh', current_data_offset,
-                                NUM_MIP_LEVELS, width, height))
+            f.write(struct.pack('iHHhh', current_data_offset,
+                                NUM_MIP_LEVELS, texture_format, width, height))
             current_header_offset += 12
 
             # Write data
@@ -311,38 +477,81 @@ def write_resource_file(filename):
 
         # Write meshes
         for texture_idx, vertices, indices in mesh_list:
-            current_data_offset = align(current_data_offset, 4)
+            # Planar attribute arrays are read with block loads, which must
+            # be aligned to a cache line.
+            current_data_offset = align(current_data_offset,
+                                        64 if planar_vertices else 4)
 
             # Write file header
+            flags = mesh_flags(vertices)
             f.seek(current_header_offset)
-            f.write(struct.pack('iiii', current_data_offset,
-                                texture_idx, len(vertices), len(indices)))
-            current_header_offset += 16
+            f.write(struct.pack('iiii6fI', current_data_offset,
+                                texture_idx, len(vertices), len(indices),
+                                *mesh_bounds(vertices), flags))
+            current_header_offset += 44
+
+            # Position, texture coordinate, normal. Quantized meshes store
+            # half float texture coordinates and signed normalized normals.
+            if flags & MESH_QUANTIZED:
+                formats = ['f'] * 3 + ['e'] * 2 + ['h'] * 3
+            else:
+                formats = ['f'] * 8
 
             # Write data
             f.seek(current_data_offset)
-            for vert in vertices:
-                for val in vert:
-                    f.write(struct.pack('f', val))
-                    current_data_offset += 4
-
+            if planar_vertices:
+                # Write each attribute as a separate array, padded to a
+                # multiple of 32 vertices.
+                pitch = align(len(vertices), 32)
+                for attrib, fmt in enumerate(formats):
+                    for vert in vertices:
+                        f.write(pack_attrib(fmt, vert[attrib]))
+
+                    size = struct.calcsize(fmt)
+                    f.write(bytes((pitch - len(vertices)) * size))
+                    current_data_offset += pitch * size
+            else:
+                # Pad each vertex to a multiple of four bytes
+                vertex_size = sum(struct.calcsize(fmt) for fmt in formats)
+                padding = bytes(align(vertex_size, 4) - vertex_size)
+                for vert in vertices:
+                    for fmt, val in zip(formats, vert):
+                        f.write(pack_attrib(fmt, val))
+
+                    f.write(padding)
+                    current_data_offset += vertex_size + len(padding)
+
+            index_format = 'H' if flags & MESH_INDEX16 else 'I'
             for index in indices:
-                f.write(struct.pack('I', index))
-                current_data_offset += 4
+                f.write(struct.pack(index_format, index))
+                current_data_offset += struct.calcsize(index_format)
+
+            current_data_offset = align(current_data_offset, 4)
 
         # Write file header
         f.seek(0)
         f.write(struct.pack('I', current_data_offset))  # total size
         f.write(struct.pack('I', len(texture_list)))  # num textures
         f.write(struct.pack('I', len(mesh_list)))  # num meshes
+        f.write(struct.pack('I', FILE_PLANAR_VERTICES
+                            if planar_vertices else 0))  # flags
 
         print('wrote ' + filename)
 
 # Main
-if len(sys.argv) < 2:
-    print('enter the name of a .OBJ file')
-    sys.exit(1)
-
-read_obj_file(sys.argv[1])
+parser = argparse.ArgumentParser()
+parser.add_argument('--compress', action='store_true',
+                    help='store textures in BC1/BC3 block compressed format')
+parser.add_argument('--planar', action='store_true',
+                    help='store each vertex attribute in a separate array')
+parser.add_argument('--quantize', action='store_true',
+                    help='use 16-bit indices, normals, and texture coordinates where possible')
+parser.add_argument('obj_file', help='Wavefront .OBJ file to convert')
+args = parser.parse_args()
+compress_textures = args.compress
+planar_vertices = args.planar
+quantize = args.quantize
+
+read_obj_file(args.obj_file)
 print_stats()
 write_resource_file('resource.bin')
@@ -19,6 +19,9 @@
 #define ROTATION_SPEED M_PI/16
 #define MOVEMENT_SPEED 1.0
 
+// Print render statistics every this many frames. 0 disables.
+#define STATS_INTERVAL 0
+
 smdb_t *smdb;
 
 // PROTOTYPES
@@ -39,6 +42,10 @@ int main() {
 
     SceneView *sv = new SceneView();
     sv->start();
+    if (STATS_INTERVAL != 0) {
+        sv->enablePerfCounterStats();
+    }
+
     start_all_threads();
 
     // If this is set, the camera rotates around the object.
@@ -112,6 +119,10 @@ int main() {
         if (frame % 10 == 0) {
             printf("F: %d\n\r", (uint32_t)actions);
         }
+
+        if (STATS_INTERVAL != 0 && frame % STATS_INTERVAL == 0) {
+            sv->printStats();
+        }
     }
     return 0;
 }
@@ -27,7 +27,10 @@ struct ShadowMapUniforms
     Matrix fMVPMatrix;
 };
 
-// Represents depth as a brightness
+// Renders the scene from the light's point of view. The shadow map target
+// only has a depth buffer, so shadePixels is only called when the scene is
+// drawn to the screen with SHOW_SHADOW_MAP, which represents depth as a
+// brightness.
 class ShadowMapShader : public Shader
 {
 public:
@@ -64,26 +64,20 @@ int main()
 
     RenderContext *context = new RenderContext();
 
-    // Shadow map that is both a source texture and render target
-    // XXX Ideally we would make this texture 16 bits with a single channel,
-    // but librender currently hardcodes one surface format (RGBA8888),
-    // which wastes some memory and limits the depth resolution to 256.
-    // It would also be ideal to bind the texture as the depth buffer so
-    // we didn't need a color buffer.
-    Surface *lightMapSurface = new Surface(kLightmapSize, kLightmapSize);
-    Surface *lightDepthBuffer = new Surface(kLightmapSize, kLightmapSize);
+    // Shadow map. The light pass renders to a target with only a 16 bit
+    // depth buffer, which the output pass then samples as a texture.
+    Surface *lightDepthBuffer = new Surface(kLightmapSize, kLightmapSize, kR16);
     RenderTarget *lightMapTarget = new RenderTarget();
-    lightMapTarget->setColorBuffer(lightMapSurface);
     lightMapTarget->setDepthBuffer(lightDepthBuffer);
     Shader *lightMapShader = new ShadowMapShader();
     Texture *lightMapTexture = new Texture();
     lightMapTexture->enableBilinearFiltering(true);
-    lightMapTexture->setMipSurface(0, lightMapSurface);
+    lightMapTexture->setMipSurface(0, lightDepthBuffer);
 
     // Output framebuffer target
     RenderTarget *outputTarget = new RenderTarget();
     Surface *colorBuffer = new Surface(FB_WIDTH, FB_HEIGHT, frameBuffer);
-    Surface *depthBuffer = new Surface(FB_WIDTH, FB_HEIGHT);
+    Surface *depthBuffer = new Surface(FB_WIDTH, FB_HEIGHT, kR16);
     outputTarget->setColorBuffer(colorBuffer);
     outputTarget->setDepthBuffer(depthBuffer);
 #if !SHOW_SHADOW_MAP
@@ -0,0 +1,204 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <nyuzi.h>
+#include <RenderContext.h>
+#include <RenderTarget.h>
+#include <schedule.h>
+#include <stdio.h>
+#include <Surface.h>
+
+using namespace librender;
+
+//
+// This benchmark measures the triangle setup phase, which culls triangles
+// and inserts them into the queues of the tiles they overlap. Each bucket
+// draws random triangles whose bounding box is at most the given number of
+// pixels on a side. Larger triangles are inserted into more tile queues.
+// The vertex and pixel shaders do almost nothing. Only the setup phase
+// time is reported.
+//
+// Afterwards, one frame is rendered and a checksum of its pixels compared
+// against a known value, to catch changes that render the wrong image. The
+// triangles come from a fixed pseudo random sequence rather than rand(),
+// so they are the same with any C library.
+//
+
+namespace
+{
+
+const int kNumTriangles = 4096;
+const int kNumFrames = 4;
+const int kTargetSize = 256;
+const int kBucketSizes[] = { 4, 16, 64, 256 };
+const int kChecksumBucketSize = 64;
+const unsigned int kExpectedChecksum = 0x374b1b6d;
+
+// Vertices are already in clip space.
+class PassThroughShader : public Shader
+{
+public:
+    PassThroughShader()
+        :	Shader(2, 4)
+    {
+    }
+
+    void shadeVertices(vecf16_t *outParams, const vecf16_t *inAttribs, const void *,
+                       vmask_t) const override
+    {
+        outParams[0] = inAttribs[0];
+        outParams[1] = inAttribs[1];
+        outParams[2] = -1.0f;
+        outParams[3] = 1.0f;
+    }
+
+    void shadePixels(vecf16_t *outColor, const vecf16_t *, const void *,
+                     const Texture * const *, vmask_t) const override
+    {
+        outColor[kColorR] = 1.0f;
+        outColor[kColorG] = 1.0f;
+        outColor[kColorB] = 1.0f;
+        outColor[kColorA] = 1.0f;
+    }
+};
+
+float gVertices[kNumTriangles * 3 * 2];
+int gIndices[kNumTriangles * 3];
+
+unsigned int gRandomState = 1;
+
+// Linear congruential generator from the C standard's example rand()
+int nextRandom()
+{
+    gRandomState = gRandomState * 1103515245 + 12345;
+    return static_cast<int>((gRandomState >> 16) & 0x7fff);
+}
+
+float toClipSpace(int pixel)
+{
+    return static_cast<float>(pixel) * 2.0f / kTargetSize - 1.0f;
+}
+
+void makeTriangles(int size)
+{
+    for (int tri = 0; tri < kNumTriangles; tri++)
+    {
+        const int left = nextRandom() % (kTargetSize - size + 1);
+        const int top = nextRandom() % (kTargetSize - size + 1);
+        int x[3];
+        int y[3];
+        int area;
+        do
+        {
+            for (int vertex = 0; vertex < 3; vertex++)
+            {
+                x[vertex] = left + nextRandom() % (size + 1);
+                y[vertex] = top + nextRandom() % (size + 1);
+            }
+
+            area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        }
+        while (area == 0);
+
+        // Make all triangles face the camera so none are culled
+        const int order[3] = { 0, area > 0 ? 1 : 2, area > 0 ? 2 : 1 };
+        for (int vertex = 0; vertex < 3; vertex++)
+        {
+            gVertices[(tri * 3 + vertex) * 2] = toClipSpace(x[order[vertex]]);
+            gVertices[(tri * 3 + vertex) * 2 + 1] = toClipSpace(y[order[vertex]]);
+        }
+    }
+}
+
+void runTest(RenderContext *context, const RenderBuffer *vertices,
+             const RenderBuffer *indices, int size)
+{
+    unsigned int cycles = 0;
+    int trianglesBinned = 0;
+    int tileEntries = 0;
+    for (int frame = 0; frame < kNumFrames; frame++)
+    {
+        context->bindVertexAttrs(vertices);
+        context->drawElements(indices);
+        context->finish();
+
+        const RenderStats &stats = context->getStats();
+        cycles += stats.phaseCycles[RenderStats::kTriangleSetup];
+        trianglesBinned += stats.trianglesBinned;
+        for (int tile = 0; tile < stats.numTiles; tile++)
+            tileEntries += stats.tileTriangles[tile];
+    }
+
+    printf("%3dx%-3d %6u cycles/triangle %5.2f tiles/triangle %5d binned\n", size, size,
+           cycles / (kNumTriangles * kNumFrames),
+           static_cast<double>(tileEntries) / trianglesBinned, trianglesBinned / kNumFrames);
+}
+
+// FNV-1a hash of the pixels in the surface
+unsigned int checksumSurface(const Surface *surface)
+{
+    const unsigned int *pixels = static_cast<const unsigned int*>(surface->bits());
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < surface->getWidth() * surface->getHeight(); i++)
+        hash = (hash ^ pixels[i]) * 16777619u;
+
+    return hash;
+}
+
+bool checkFrame(RenderContext *context, const RenderTarget *target,
+                const RenderBuffer *vertices, const RenderBuffer *indices)
+{
+    makeTriangles(kChecksumBucketSize);
+    context->clearColorBuffer();
+    context->bindVertexAttrs(vertices);
+    context->drawElements(indices);
+    context->finish();
+
+    const unsigned int checksum = checksumSurface(target->getColorBuffer());
+    printf("frame checksum %08x, expected %08x: %s\n", checksum, kExpectedChecksum,
+           checksum == kExpectedChecksum ? "PASS" : "FAIL");
+    return checksum == kExpectedChecksum;
+}
+
+} // namespace
+
+// All threads start execution here.
+int main()
+{
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    for (int i = 0; i < kNumTriangles * 3; i++)
+        gIndices[i] = i;
+
+    RenderBuffer *vertices = new RenderBuffer(gVertices, kNumTriangles * 3, 2 * sizeof(float));
+    RenderBuffer *indices = new RenderBuffer(gIndices, kNumTriangles * 3, sizeof(int));
+    RenderTarget *target = new RenderTarget();
+    target->setColorBuffer(new Surface(kTargetSize, kTargetSize));
+    RenderContext *context = new RenderContext(0x400000);
+    context->bindTarget(target);
+    context->bindShader(new PassThroughShader());
+
+    start_all_threads();
+
+    for (int size : kBucketSizes)
+    {
+        makeTriangles(size);
+        runTest(context, vertices, indices, size);
+    }
+
+    return checkFrame(context, target, vertices, indices) ? 0 : 1;
+}
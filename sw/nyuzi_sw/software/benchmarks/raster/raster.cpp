@@ -0,0 +1,111 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <nyuzi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <Rasterizer.h>
+#include <RenderState.h>
+#include <RenderTarget.h>
+#include <Surface.h>
+#include <TriangleFiller.h>
+
+using namespace librender;
+
+//
+// This benchmark measures rasterizer throughput for triangles of different
+// sizes. Each bucket rasterizes random triangles whose bounding box is at
+// most the given number of pixels on a side into one tile. The filler only
+// writes depth, so most of the time is spent in fillTriangle. Triangles up
+// to kMaxSmallTriangle pixels (Rasterizer.cpp) use the small triangle path,
+// larger ones are subdivided recursively.
+//
+
+namespace
+{
+
+const int kNumTriangles = 1000;
+const int kBucketSizes[] = { 2, 4, 8, 16, 32, 64 };
+
+struct TestTriangle
+{
+    int x1, y1, x2, y2, x3, y3;
+};
+
+TestTriangle gTriangles[kNumTriangles];
+
+void makeTriangles(int size)
+{
+    for (TestTriangle &tri : gTriangles)
+    {
+        const int left = rand() % (kDefaultTileSize - size + 1);
+        const int top = rand() % (kDefaultTileSize - size + 1);
+        int area;
+        do
+        {
+            tri.x1 = left + rand() % size;
+            tri.y1 = top + rand() % size;
+            tri.x2 = left + rand() % size;
+            tri.y2 = top + rand() % size;
+            tri.x3 = left + rand() % size;
+            tri.y3 = top + rand() % size;
+            area = (tri.x2 - tri.x1) * (tri.y3 - tri.y1) - (tri.x3 - tri.x1) * (tri.y2 - tri.y1);
+        }
+        while (area == 0);
+
+        // The rasterizer expects counter-clockwise winding
+        if (area > 0)
+        {
+            int temp = tri.x2;
+            tri.x2 = tri.x3;
+            tri.x3 = temp;
+            temp = tri.y2;
+            tri.y2 = tri.y3;
+            tri.y3 = temp;
+        }
+    }
+}
+
+} // namespace
+
+int main()
+{
+    Surface *depthBuffer = new Surface(kDefaultTileSize, kDefaultTileSize, kR32F);
+    RenderTarget *target = new RenderTarget();
+    target->setDepthBuffer(depthBuffer);
+    RenderState *state = new RenderState();
+    TriangleFiller *filler = new TriangleFiller(target);
+    filler->setPass(TriangleFiller::kDepthOnlyPass);
+    filler->setUpTriangle(state, -1.0f, -1.0f, -2.0f, 1.0f, -1.0f, -2.0f, 1.0f, 1.0f, -2.0f);
+
+    for (int size : kBucketSizes)
+    {
+        makeTriangles(size);
+        depthBuffer->clearTile(0, 0, 0xff800000);
+        const unsigned int startCycles = get_cycle_count();
+        for (const TestTriangle &tri : gTriangles)
+        {
+            fillTriangle(*filler, 0, 0, kDefaultTileSize, tri.x1, tri.y1, tri.x2, tri.y2,
+                         tri.x3, tri.y3, kDefaultTileSize, kDefaultTileSize);
+        }
+
+        const unsigned int cycles = get_cycle_count() - startCycles;
+        printf("%2dx%-2d %7u cycles/triangle %9u triangles/Mcycle\n", size, size,
+               cycles / kNumTriangles, kNumTriangles * 1000000u / cycles);
+    }
+
+    return 0;
+}
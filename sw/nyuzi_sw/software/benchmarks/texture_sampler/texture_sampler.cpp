@@ -0,0 +1,129 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <math.h>
+#include <nyuzi.h>
+#include <performance_counters.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <Shader.h>
+#include <Surface.h>
+#include <Texture.h>
+
+using namespace librender;
+
+//
+// This benchmark measures texture sampler memory behavior. It samples a
+// rotated texture with bilinear filtering, the way a textured floor or the
+// rotozoom demo would, and reports cycles and cache misses for the linear
+// and tiled surface layouts. The texture is larger than the L2 cache.
+// The checksum should be the same for both layouts.
+//
+
+namespace
+{
+
+const int kTextureSize = 512;
+const int kSampleSize = 256;
+const int kAngles[] = { 0, 30, 45, 60, 85 };
+
+struct Layout
+{
+    const char *name;
+    SurfaceFormat format;
+};
+
+const Layout kLayouts[] = {
+    { "linear", kRGBA8888 },
+    { "tiled", kRGBA8888Tiled }
+};
+
+void runTest(const Texture &texture, int angle, const char *layoutName)
+{
+    const float kPi = 3.14159265f;
+    const float kTexelSize = 1.0f / kTextureSize;
+    const float cosAngle = cosf(angle * kPi / 180.0f) * kTexelSize;
+    const float sinAngle = sinf(angle * kPi / 180.0f) * kTexelSize;
+    const vecf16_t kXOffsets = { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 };
+    const vecf16_t kYOffsets = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 };
+    vecf16_t color[4];
+    vecf16_t checksum = 0.0f;
+
+    unsigned int startCycles = get_cycle_count();
+    unsigned int startL1Misses = read_perf_counter(0);
+    unsigned int startL2Misses = read_perf_counter(1);
+    for (int y = 0; y < kSampleSize; y += 4)
+    {
+        for (int x = 0; x < kSampleSize; x += 4)
+        {
+            // Rotate the sample grid around the center of the texture
+            const vecf16_t sx = kXOffsets + static_cast<float>(x - kSampleSize / 2);
+            const vecf16_t sy = kYOffsets + static_cast<float>(y - kSampleSize / 2);
+            const vecf16_t u = sx * cosAngle - sy * sinAngle + 0.5f;
+            const vecf16_t v = sx * sinAngle + sy * cosAngle + 0.5f;
+            texture.readPixels(u, v, 0xffff, color);
+            checksum += color[kColorR] + color[kColorG] + color[kColorB];
+        }
+    }
+
+    unsigned int cycles = get_cycle_count() - startCycles;
+    unsigned int l1Misses = read_perf_counter(0) - startL1Misses;
+    unsigned int l2Misses = read_perf_counter(1) - startL2Misses;
+    float total = 0.0f;
+    for (int lane = 0; lane < 16; lane++)
+        total += checksum[lane];
+
+    printf("%2d degrees %-6s %9u cycles %7u L1D misses %7u L2 misses (checksum %g)\n",
+           angle, layoutName, cycles, l1Misses, l2Misses, static_cast<double>(total));
+}
+
+} // namespace
+
+int main()
+{
+    set_perf_counter_event(0, PERF_DCACHE_MISS);
+    set_perf_counter_event(1, PERF_L2_MISS);
+
+    // Fill with a pattern that changes in both directions
+    unsigned int *pixels = static_cast<unsigned int*>(malloc(kTextureSize * kTextureSize
+                           * sizeof(unsigned int)));
+    for (int y = 0; y < kTextureSize; y++)
+    {
+        for (int x = 0; x < kTextureSize; x++)
+        {
+            pixels[y * kTextureSize + x] = 0xff000000 | static_cast<unsigned int>((x ^ y) & 0xff)
+                                           | static_cast<unsigned int>((x * 3 & 0xff) << 8)
+                                           | static_cast<unsigned int>((y * 5 & 0xff) << 16);
+        }
+    }
+
+    for (const Layout &layout : kLayouts)
+    {
+        Surface *surface = new Surface(kTextureSize, kTextureSize, layout.format);
+        surface->loadPixels(pixels);
+        Texture *texture = new Texture();
+        texture->setMipSurface(0, surface);
+        texture->enableBilinearFiltering(true);
+        for (int angle : kAngles)
+            runTest(*texture, angle, layout.name);
+
+        delete texture;
+        delete surface;
+    }
+
+    free(pixels);
+    return 0;
+}
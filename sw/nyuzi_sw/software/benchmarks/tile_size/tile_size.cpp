@@ -0,0 +1,193 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <nyuzi.h>
+#include <performance_counters.h>
+#include <RenderContext.h>
+#include <RenderTarget.h>
+#include <schedule.h>
+#include <stdio.h>
+#include <Surface.h>
+
+using namespace librender;
+
+//
+// This benchmark renders the same frame with each tile size that
+// RenderContext::setTileSize supports, and reports the cycles and L2 cache
+// misses per frame for each. The frame has random, depth tested triangles
+// of mixed sizes with interpolated colors, at the resolution of the
+// framebuffer. Use it to pick a tile size for a hardware configuration.
+//
+
+namespace
+{
+
+const int kNumTriangles = 2048;
+const int kNumFrames = 4;
+const int kWidth = 640;
+const int kHeight = 480;
+const int kMaxTriangleSize = 96;
+const int kTileSizes[] = { 32, 64, 128 };
+
+// Attributes are x, y, z in clip space and r, g, b
+const int kAttrsPerVertex = 6;
+
+class ColorShader : public Shader
+{
+public:
+    ColorShader()
+        :	Shader(kAttrsPerVertex, 7)
+    {
+    }
+
+    void shadeVertices(vecf16_t *outParams, const vecf16_t *inAttribs, const void *,
+                       vmask_t) const override
+    {
+        outParams[0] = inAttribs[0];
+        outParams[1] = inAttribs[1];
+        outParams[2] = inAttribs[2];
+        outParams[3] = 1.0f;
+        outParams[4] = inAttribs[3];
+        outParams[5] = inAttribs[4];
+        outParams[6] = inAttribs[5];
+    }
+
+    void shadePixels(vecf16_t *outColor, const vecf16_t *inParams, const void *,
+                     const Texture * const *, vmask_t) const override
+    {
+        outColor[kColorR] = inParams[0];
+        outColor[kColorG] = inParams[1];
+        outColor[kColorB] = inParams[2];
+        outColor[kColorA] = 1.0f;
+    }
+};
+
+float gVertices[kNumTriangles * 3 * kAttrsPerVertex];
+int gIndices[kNumTriangles * 3];
+unsigned int gRandomState = 1;
+
+// Linear congruential generator from the C standard's example rand()
+int nextRandom()
+{
+    gRandomState = gRandomState * 1103515245 + 12345;
+    return static_cast<int>((gRandomState >> 16) & 0x7fff);
+}
+
+void makeTriangles()
+{
+    for (int tri = 0; tri < kNumTriangles; tri++)
+    {
+        const int size = 4 + nextRandom() % (kMaxTriangleSize - 3);
+        const int left = nextRandom() % (kWidth - size + 1);
+        const int top = nextRandom() % (kHeight - size + 1);
+        const float z = -1.0f - static_cast<float>(nextRandom()) / 0x7fff;
+        int x[3];
+        int y[3];
+        int area;
+        do
+        {
+            for (int vertex = 0; vertex < 3; vertex++)
+            {
+                x[vertex] = left + nextRandom() % (size + 1);
+                y[vertex] = top + nextRandom() % (size + 1);
+            }
+
+            area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        }
+        while (area == 0);
+
+        // Make all triangles face the camera so none are culled
+        const int order[3] = { 0, area > 0 ? 1 : 2, area > 0 ? 2 : 1 };
+        for (int vertex = 0; vertex < 3; vertex++)
+        {
+            float *attrs = gVertices + (tri * 3 + vertex) * kAttrsPerVertex;
+            attrs[0] = static_cast<float>(x[order[vertex]]) * 2.0f / kWidth - 1.0f;
+            attrs[1] = static_cast<float>(y[order[vertex]]) * 2.0f / kHeight - 1.0f;
+            attrs[2] = z;
+            attrs[3] = static_cast<float>(nextRandom()) / 0x7fff;
+            attrs[4] = static_cast<float>(nextRandom()) / 0x7fff;
+            attrs[5] = static_cast<float>(nextRandom()) / 0x7fff;
+        }
+    }
+}
+
+void renderFrame(RenderContext *context, const RenderBuffer *vertices,
+                 const RenderBuffer *indices)
+{
+    context->clearColorBuffer();
+    context->bindVertexAttrs(vertices);
+    context->drawElements(indices);
+    context->finish();
+}
+
+void runTest(RenderContext *context, const RenderBuffer *vertices,
+             const RenderBuffer *indices, int tileSize)
+{
+    context->setTileSize(tileSize);
+
+    // The first frame with a new tile size clears every tile
+    renderFrame(context, vertices, indices);
+
+    unsigned int cycles = 0;
+    unsigned int l2Misses = 0;
+    for (int frame = 0; frame < kNumFrames; frame++)
+    {
+        renderFrame(context, vertices, indices);
+        const RenderStats &stats = context->getStats();
+        for (int phase = 0; phase < RenderStats::kNumPhases; phase++)
+        {
+            cycles += stats.phaseCycles[phase];
+            l2Misses += stats.phasePerfCounters[phase][0];
+        }
+    }
+
+    printf("%3dx%-3d %9u cycles/frame %7u L2 misses/frame\n", tileSize, tileSize,
+           cycles / kNumFrames, l2Misses / kNumFrames);
+}
+
+} // namespace
+
+// All threads start execution here.
+int main()
+{
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    makeTriangles();
+    for (int i = 0; i < kNumTriangles * 3; i++)
+        gIndices[i] = i;
+
+    RenderBuffer *vertices = new RenderBuffer(gVertices, kNumTriangles * 3,
+            kAttrsPerVertex * sizeof(float));
+    RenderBuffer *indices = new RenderBuffer(gIndices, kNumTriangles * 3, sizeof(int));
+    RenderTarget *target = new RenderTarget();
+    target->setColorBuffer(new Surface(kWidth, kHeight));
+    target->setDepthBuffer(new Surface(kWidth, kHeight, kR32F));
+    RenderContext *context = new RenderContext(0x400000);
+    context->bindTarget(target);
+    context->bindShader(new ColorShader());
+    context->enableDepthBuffer(true);
+
+    set_perf_counter_event(0, PERF_L2_MISS);
+    context->enablePerfCounterStats(true);
+
+    start_all_threads();
+
+    for (int tileSize : kTileSizes)
+        runTest(context, vertices, indices, tileSize);
+
+    return 0;
+}
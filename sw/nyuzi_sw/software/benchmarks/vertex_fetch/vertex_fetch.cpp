@@ -0,0 +1,177 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <Matrix.h>
+#include <nyuzi.h>
+#include <performance_counters.h>
+#include <RenderContext.h>
+#include <RenderTarget.h>
+#include <schedule.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <Surface.h>
+
+using namespace librender;
+
+//
+// This benchmark measures the vertex shading phase for a large mesh stored
+// in the interleaved and planar RenderBuffer layouts. Vertices have the
+// same attributes as scene_viewer (position, normal, texture coordinate).
+// The shader does a typical amount of work, and the index buffer only has
+// one triangle, so the time is mostly spent fetching attributes and
+// transforming vertices.
+//
+
+namespace
+{
+
+const int kNumVertices = 0x10000;
+const int kAttribsPerVertex = 8;
+const int kNumFrames = 4;
+const int kTargetSize = 64;
+const int kIndices[] = { 0, 1, 2 };
+
+struct VertexUniforms
+{
+    Matrix fMVPMatrix;
+    Matrix fNormalMatrix;
+};
+
+class VertexShader : public Shader
+{
+public:
+    VertexShader()
+        :	Shader(kAttribsPerVertex, 9)
+    {
+    }
+
+    void shadeVertices(vecf16_t *outParams, const vecf16_t *inAttribs, const void *_uniforms,
+                       vmask_t) const override
+    {
+        const VertexUniforms *uniforms = static_cast<const VertexUniforms*>(_uniforms);
+
+        vecf16_t coord[4];
+        for (int i = 0; i < 3; i++)
+            coord[i] = inAttribs[i];
+
+        coord[3] = 1.0f;
+        uniforms->fMVPMatrix.mulVec(outParams, coord);
+
+        // Normal
+        vecf16_t normal[4];
+        for (int i = 0; i < 3; i++)
+            normal[i] = inAttribs[i + 3];
+
+        normal[3] = 0.0f;
+        vecf16_t transformedNormal[4];
+        uniforms->fNormalMatrix.mulVec(transformedNormal, normal);
+        for (int i = 0; i < 3; i++)
+            outParams[i + 4] = transformedNormal[i];
+
+        // Texture coordinate
+        outParams[7] = inAttribs[6];
+        outParams[8] = inAttribs[7];
+    }
+
+    void shadePixels(vecf16_t *outColor, const vecf16_t *, const void *,
+                     const Texture * const *, vmask_t) const override
+    {
+        outColor[kColorR] = 1.0f;
+        outColor[kColorG] = 1.0f;
+        outColor[kColorB] = 1.0f;
+        outColor[kColorA] = 1.0f;
+    }
+};
+
+float attribValue(int vertex, int attrib)
+{
+    return static_cast<float>((vertex * kAttribsPerVertex + attrib) % 1000) * 0.001f;
+}
+
+void runTest(RenderContext *context, const RenderBuffer *vertices,
+             const RenderBuffer *indices, const VertexUniforms &uniforms, const char *name)
+{
+    unsigned int cycles = 0;
+    unsigned int l1Misses = 0;
+    unsigned int l2Misses = 0;
+    for (int frame = 0; frame < kNumFrames; frame++)
+    {
+        context->bindUniforms(&uniforms, sizeof(uniforms));
+        context->bindVertexAttrs(vertices);
+        context->drawElements(indices);
+        context->finish();
+
+        const RenderStats &stats = context->getStats();
+        cycles += stats.phaseCycles[RenderStats::kVertexShading];
+        l1Misses += stats.phasePerfCounters[RenderStats::kVertexShading][0];
+        l2Misses += stats.phasePerfCounters[RenderStats::kVertexShading][1];
+    }
+
+    printf("%-11s %9u cycles %7u L1D misses %7u L2 misses\n", name, cycles / kNumFrames,
+           l1Misses / kNumFrames, l2Misses / kNumFrames);
+}
+
+} // namespace
+
+// All threads start execution here.
+int main()
+{
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    // Both copies are aligned to a cache line, so planar attributes are
+    // read with block loads.
+    const int planarPitch = RenderBuffer::getPlanarPitch(kNumVertices);
+    float *interleavedData = static_cast<float*>(memalign(64, kNumVertices * kAttribsPerVertex
+                             * sizeof(float)));
+    float *planarData = static_cast<float*>(memalign(64, planarPitch * kAttribsPerVertex
+                        * sizeof(float)));
+    for (int vertex = 0; vertex < kNumVertices; vertex++)
+    {
+        for (int attrib = 0; attrib < kAttribsPerVertex; attrib++)
+        {
+            interleavedData[vertex * kAttribsPerVertex + attrib] = attribValue(vertex, attrib);
+            planarData[attrib * planarPitch + vertex] = attribValue(vertex, attrib);
+        }
+    }
+
+    RenderBuffer *interleavedVertices = new RenderBuffer(interleavedData, kNumVertices,
+            kAttribsPerVertex * sizeof(float));
+    RenderBuffer *planarVertices = new RenderBuffer();
+    planarVertices->setPlanarData(planarData, kNumVertices, kAttribsPerVertex);
+    RenderBuffer *indices = new RenderBuffer(kIndices, 3, sizeof(int));
+
+    RenderTarget *target = new RenderTarget();
+    target->setColorBuffer(new Surface(kTargetSize, kTargetSize));
+    RenderContext *context = new RenderContext(0x400000);
+    context->bindTarget(target);
+    context->bindShader(new VertexShader());
+    set_perf_counter_event(0, PERF_DCACHE_MISS);
+    set_perf_counter_event(1, PERF_L2_MISS);
+    context->enablePerfCounterStats(true);
+
+    VertexUniforms uniforms;
+    uniforms.fMVPMatrix = Matrix::getProjectionMatrix(kTargetSize, kTargetSize)
+                          * Matrix::getTranslationMatrix(Vec3(0, 0, -2));
+    uniforms.fNormalMatrix = Matrix();
+
+    start_all_threads();
+
+    runTest(context, interleavedVertices, indices, uniforms, "interleaved");
+    runTest(context, planarVertices, indices, uniforms, "planar");
+
+    return 0;
+}
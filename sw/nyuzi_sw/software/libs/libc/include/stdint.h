@@ -31,3 +31,4 @@ typedef unsigned int uint32_t;
 typedef long long int int64_t;
 typedef unsigned long long int uint64_t;
 typedef unsigned int intptr_t;
+typedef unsigned int uintptr_t;
@@ -87,6 +87,11 @@ public:
         fNextBucketIndex = 0;
     }
 
+    bool empty() const
+    {
+        return fFirstBucket == nullptr;
+    }
+
     // Sort all items in queue. This is not thread safe.
     void sort()
     {
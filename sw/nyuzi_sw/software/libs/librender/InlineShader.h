@@ -0,0 +1,55 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+
+#include "Shader.h"
+#include "TriangleFiller.h"
+
+namespace librender
+{
+
+//
+// Base class for shaders whose pixel shading should be compiled into the
+// pixel pipeline. Derived is the shader class itself, which must implement
+// shadePixels. The pipelines are instantiated in the translation unit that
+// includes the shader, with the number of parameters known at compile time.
+//
+// class MyShader : public InlineShader<MyShader, 8, 9>
+//
+
+template <class Derived, int kNumAttribs, int kNumParams, int kNumInstanceAttribs = 0>
+class InlineShader : public Shader
+{
+public:
+    static_assert(kNumParams >= 4 && kNumParams <= kMaxParams, "invalid parameter count");
+
+    PixelPipeline getPixelPipeline(DepthMode depthMode, bool enableBlend,
+                                   bool perspective) const override
+    {
+        return TriangleFiller::selectPipeline<Derived, kNumParams - 4>(depthMode, enableBlend,
+                perspective);
+    }
+
+protected:
+    InlineShader()
+        :	Shader(kNumAttribs, kNumParams, kNumInstanceAttribs)
+    {
+    }
+};
+
+} // namespace librender
@@ -0,0 +1,48 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include "Surface.h"
+
+namespace librender
+{
+
+//
+// This is subclassed by the application to apply a full screen effect, such
+// as fog, tone mapping, or color grading. RenderContext calls processTile for
+// each tile after its triangles have been drawn and before it is written back
+// to memory, so the pixels are still in the L2 cache. Tiles are processed by
+// several threads at once, so processTile may only read and write pixels
+// inside the tile it was passed. Filters that read neighboring pixels must
+// clamp at the tile edges. Surface::readBlock and writeBlockMasked access
+// 4x4 blocks in each buffer.
+//
+
+class PostProcessor
+{
+public:
+    virtual ~PostProcessor() {}
+
+    // left and top are the pixel coordinates of the upper left corner of the
+    // tile. right and bottom are exclusive, and are clipped to the edges of
+    // the render target. depthBuffer is null if the render target doesn't
+    // have one.
+    virtual void processTile(Surface *colorBuffer, const Surface *depthBuffer, int left,
+                             int top, int right, int bottom) const = 0;
+};
+
+} // namespace librender
@@ -30,43 +30,45 @@ namespace librender
 namespace
 {
 
-const int kMaxSweep = 0;
+// Triangles whose bounding box is at most this many pixels wide and high
+// are rasterized by testing each 4x4 block in the box (rasterizeSmall).
+const int kMaxSmallTriangle = 16;
 const veci16_t kXStep = { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 };
 const veci16_t kYStep = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 };
 
-void setupRecurseEdge(int tileLeft, int tileTop, int x1, int y1,
+void setupRecurseEdge(int tileLeft, int tileTop, int tileSize, int x1, int y1,
                       int x2, int y2, int &outAcceptEdgeValue, int &outRejectEdgeValue,
                       veci16_t &outAcceptStepMatrix, veci16_t &outRejectStepMatrix)
 {
-    veci16_t xAcceptStepValues = kXStep * (kTileSize / 4);
-    veci16_t yAcceptStepValues = kYStep * (kTileSize / 4);
+    veci16_t xAcceptStepValues = kXStep * (tileSize / 4);
+    veci16_t yAcceptStepValues = kYStep * (tileSize / 4);
     veci16_t xRejectStepValues = xAcceptStepValues;
     veci16_t yRejectStepValues = yAcceptStepValues;
     int trivialAcceptX = tileLeft;
     int trivialAcceptY = tileTop;
     int trivialRejectX = tileLeft;
     int trivialRejectY = tileTop;
-    const int kThreeQuarterTile = kTileSize * 3 / 4;
+    const int kThreeQuarterTile = tileSize * 3 / 4;
 
     if (y2 > y1)
     {
-        trivialAcceptX += kTileSize - 1;
+        trivialAcceptX += tileSize - 1;
         xAcceptStepValues = xAcceptStepValues - kThreeQuarterTile;
     }
     else
     {
-        trivialRejectX += kTileSize - 1;
+        trivialRejectX += tileSize - 1;
         xRejectStepValues = xRejectStepValues - kThreeQuarterTile;
     }
 
     if (x2 > x1)
     {
-        trivialRejectY += kTileSize - 1;
+        trivialRejectY += tileSize - 1;
         yRejectStepValues = yRejectStepValues - kThreeQuarterTile;
     }
     else
     {
-        trivialAcceptY += kTileSize - 1;
+        trivialAcceptY += tileSize - 1;
         yAcceptStepValues = yAcceptStepValues - kThreeQuarterTile;
     }
 
@@ -214,10 +216,16 @@ void subdivideTile(
     }
 }
 
+// Each level of recursion divides a square into a 4x4 grid, so the size of
+// the root must be a power of four. For other tile sizes, this starts from
+// the next larger power of four, and the parts outside the tile are clipped.
 void rasterizeRecursive(TriangleFiller &filler,
-                        int tileLeft, int tileTop, int clipRight, int clipBottom,
+                        int tileLeft, int tileTop, int tileSize, int clipRight, int clipBottom,
                         int x1, int y1, int x2, int y2, int x3, int y3)
 {
+    const int rootSizeBits = (__builtin_ctz(static_cast<unsigned int>(tileSize)) + 1) & ~1;
+    const int rootSize = 1 << rootSizeBits;
+
     int acceptValue1;
     int rejectValue1;
     veci16_t acceptStepMatrix1;
@@ -233,11 +241,11 @@ void rasterizeRecursive(TriangleFiller &filler,
 
     // This assumes counter-clockwise winding for triangles that are
     // facing the camera.
-    setupRecurseEdge(tileLeft, tileTop, x1, y1, x3, y3, acceptValue1, rejectValue1,
+    setupRecurseEdge(tileLeft, tileTop, rootSize, x1, y1, x3, y3, acceptValue1, rejectValue1,
                      acceptStepMatrix1, rejectStepMatrix1);
-    setupRecurseEdge(tileLeft, tileTop, x3, y3, x2, y2, acceptValue2, rejectValue2,
+    setupRecurseEdge(tileLeft, tileTop, rootSize, x3, y3, x2, y2, acceptValue2, rejectValue2,
                      acceptStepMatrix2, rejectStepMatrix2);
-    setupRecurseEdge(tileLeft, tileTop, x2, y2, x1, y1, acceptValue3, rejectValue3,
+    setupRecurseEdge(tileLeft, tileTop, rootSize, x2, y2, x1, y1, acceptValue3, rejectValue3,
                      acceptStepMatrix3, rejectStepMatrix3);
 
     subdivideTile(
@@ -254,7 +262,7 @@ void rasterizeRecursive(TriangleFiller &filler,
         rejectStepMatrix1,
         rejectStepMatrix2,
         rejectStepMatrix3,
-        __builtin_ctz(kTileSize),
+        rootSizeBits,
         tileLeft,
         tileTop,
         clipRight,
@@ -273,27 +281,30 @@ inline int max3(int a, int b, int c)
     return c > value ? c : value;
 }
 
-inline void setupSweepEdge(int left, int top, int x1, int y1, int x2, int y2,
-                           int &outXStep4, int &outYStep4, veci16_t &outEdgeValue)
+// Compute the edge function for each pixel of the 4x4 block at left, top,
+// using the same equation and fill convention as setupRecurseEdge. Pixels
+// with a value less than or equal to zero are inside the edge.
+inline veci16_t setupBlockEdge(int left, int top, int x1, int y1, int x2, int y2,
+                               int &outXStep4, int &outYStep4)
 {
-    int xStep1 = y2 - y1;
-    int yStep1 = x2 - x1;
-    outEdgeValue = (kXStep + left - x2) * xStep1
-                   - (kYStep + top - y2) * yStep1;
+    const int xStep = y2 - y1;
+    const int yStep = x2 - x1;
+    veci16_t edgeValue = (kXStep + (left - x1)) * xStep - (kYStep + (top - y1)) * yStep;
     if (y1 > y2 || (y1 == y2 && x2 > x1))
-        outEdgeValue -= 1;	// Left or top edge
+        edgeValue += 1;	// Left or top edge
 
-    outXStep4 = xStep1 * 4;
-    outYStep4 = yStep1 * 4;
+    outXStep4 = xStep * 4;
+    outYStep4 = yStep * 4;
+    return edgeValue;
 }
 
 //
-// For smaller triangles, this skips the setup overhead of the recursive rasterizer.
-// It instead steps the 4x4 grid over the bounding box of the triangle in a serpentine
-// pattern.
-// Currently disabled.
+// For small triangles, the setup and the levels of subdivision in the
+// recursive rasterizer cost more than just testing every 4x4 block in the
+// bounding box. This evaluates the three edge functions for 16 pixels at a
+// time, stepping them by one block at a time over the box.
 //
-void rasterizeSweep(TriangleFiller &filler,
+void rasterizeSmall(TriangleFiller &filler,
                     int bbLeft, int bbTop, int bbRight, int bbBottom,
                     int x1, int y1, int x2, int y2, int x3, int y3)
 {
@@ -303,70 +314,63 @@ void rasterizeSweep(TriangleFiller &filler,
     int yStep4_2;
     int xStep4_3;
     int yStep4_3;
-    veci16_t edgeValue1;
-    veci16_t edgeValue2;
-    veci16_t edgeValue3;
-
-    setupSweepEdge(bbLeft, bbTop, x1, y1, x2, y2, xStep4_1, yStep4_1, edgeValue1);
-    setupSweepEdge(bbLeft, bbTop, x2, y2, x3, y3, xStep4_2, yStep4_2, edgeValue2);
-    setupSweepEdge(bbLeft, bbTop, x3, y3, x1, y1, xStep4_3, yStep4_3, edgeValue3);
-
-    int col = bbLeft;
-    int row = bbTop;
-    int stepDir = 4;
-    int numCols = (bbRight - bbLeft) / 4;
-    do
+
+    // Same edges as rasterizeRecursive
+    veci16_t rowEdgeValue1 = setupBlockEdge(bbLeft, bbTop, x1, y1, x3, y3, xStep4_1, yStep4_1);
+    veci16_t rowEdgeValue2 = setupBlockEdge(bbLeft, bbTop, x3, y3, x2, y2, xStep4_2, yStep4_2);
+    veci16_t rowEdgeValue3 = setupBlockEdge(bbLeft, bbTop, x2, y2, x1, y1, xStep4_3, yStep4_3);
+
+    for (int top = bbTop; top < bbBottom; top += 4)
     {
-        for (int colCount = 0; ; colCount++)
+        veci16_t edgeValue1 = rowEdgeValue1;
+        veci16_t edgeValue2 = rowEdgeValue2;
+        veci16_t edgeValue3 = rowEdgeValue3;
+        for (int left = bbLeft; left < bbRight; left += 4)
         {
-            vmask_t mask = __builtin_nyuzi_mask_cmpi_sge(edgeValue1, veci16_t(0))
-                       & __builtin_nyuzi_mask_cmpi_sge(edgeValue2, veci16_t(0))
-                       & __builtin_nyuzi_mask_cmpi_sge(edgeValue3, veci16_t(0));
+            const vmask_t mask = __builtin_nyuzi_mask_cmpi_sle(edgeValue1, veci16_t(0))
+                                 & __builtin_nyuzi_mask_cmpi_sle(edgeValue2, veci16_t(0))
+                                 & __builtin_nyuzi_mask_cmpi_sle(edgeValue3, veci16_t(0));
             if (mask)
-                filler.fillMasked(col, row, mask);
-
-            if (colCount == numCols)
-                break;
+                filler.fillMasked(left, top, mask);
 
-            // Step left/right
             edgeValue1 += xStep4_1;
             edgeValue2 += xStep4_2;
             edgeValue3 += xStep4_3;
-            col += stepDir;
         }
 
-        // Change direction, step down
-        xStep4_1 = -xStep4_1;
-        xStep4_2 = -xStep4_2;
-        xStep4_3 = -xStep4_3;
-        stepDir = -stepDir;
-        edgeValue1 -= yStep4_1;
-        edgeValue2 -= yStep4_2;
-        edgeValue3 -= yStep4_3;
-        row += 4;
+        rowEdgeValue1 -= yStep4_1;
+        rowEdgeValue2 -= yStep4_2;
+        rowEdgeValue3 -= yStep4_3;
     }
-    while (row < bbBottom);
 }
 
 } // namespace
 
 void fillTriangle(TriangleFiller &filler,
-                  int tileLeft, int tileTop,
+                  int tileLeft, int tileTop, int tileSize,
                   int x1, int y1, int x2, int y2, int x3, int y3,
                   int clipRight, int clipBottom)
 {
-    int bbLeft = max(min3(x1, x2, x3) & ~3, tileLeft);
-    int bbTop = max(min3(y1, y2, y3) & ~3, tileTop);
-    int bbRight = min3((max3(x1, x2, x3) + 3) & ~3, clipRight, tileLeft + kTileSize);
-    int bbBottom = min3((max3(y1, y2, y3) + 3) & ~3, clipBottom, tileTop + kTileSize);
+    clipRight = min(clipRight, tileLeft + tileSize);
+    clipBottom = min(clipBottom, tileTop + tileSize);
 
-    if (bbRight - bbLeft < kMaxSweep && bbBottom - bbTop < kMaxSweep)
-        rasterizeSweep(filler, bbLeft, bbTop, bbRight, bbBottom, x1, y1, x2, y2, x3, y3);
+    // Bounding box, in 4x4 blocks, of the part of the triangle in this
+    // tile. The right and bottom edges are exclusive.
+    const int bbLeft = max(min3(x1, x2, x3) & ~3, tileLeft);
+    const int bbTop = max(min3(y1, y2, y3) & ~3, tileTop);
+    const int bbRight = min((max3(x1, x2, x3) + 4) & ~3, clipRight);
+    const int bbBottom = min((max3(y1, y2, y3) + 4) & ~3, clipBottom);
+
+    if (bbRight - bbLeft <= kMaxSmallTriangle && bbBottom - bbTop <= kMaxSmallTriangle)
+    {
+        if (bbRight > bbLeft && bbBottom > bbTop)
+            rasterizeSmall(filler, bbLeft, bbTop, bbRight, bbBottom, x1, y1, x2, y2, x3, y3);
+    }
     else
     {
-        rasterizeRecursive(filler, tileLeft, tileTop, clipRight, clipBottom,
+        rasterizeRecursive(filler, tileLeft, tileTop, tileSize, clipRight, clipBottom,
                            x1, y1, x2, y2, x3, y3);
     }
 }
 
-} // namespace librender
\ No newline at end of file
+} // namespace librender
@@ -23,11 +23,17 @@
 namespace librender
 {
 
-// Determine all pixels covered by a triangle and call
-// TriangleFiller::fillMasked.
+// Triangle vertices passed to fillTriangle must be no more than this many
+// pixels from the center of the render target. The edge equations are
+// products of coordinate differences, and this keeps them from overflowing
+// 32-bit integers. Triangles that extend past it are clipped during setup.
+const int kGuardBandPixels = 8192;
+
+// Determine all pixels covered by a triangle within the tile at left, top
+// and call TriangleFiller::fillMasked.
 // Triangles are wound counter-clockwise
 void fillTriangle(TriangleFiller &filler,
-                  int left, int top,
+                  int left, int top, int tileSize,
                   int x1, int y1, int x2, int y2, int x3, int y3,
                   int clipRight, int clipBottom);
 
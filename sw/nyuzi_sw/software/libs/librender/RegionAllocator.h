@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 
 namespace librender
 {
@@ -31,15 +32,37 @@ namespace librender
 //   to minimize synchronization overhead.
 // - It doesn't have any internal fragmentation.
 //
+// When the current chunk fills up, this chains a new one. Allocations that
+// are larger than the chunk size get a chunk of their own. reset() keeps all
+// chunks and reuses them, so after the first few frames of an application,
+// this doesn't call the system allocator at all.
+//
 
 class RegionAllocator
 {
 public:
-    explicit RegionAllocator(unsigned int arenaSize)
-        :	fArenaBase(new char[arenaSize]),
-            fTotalSize(arenaSize),
-            fNextAlloc(fArenaBase)
+    struct Stats
     {
+        // Bytes allocated between the last two calls to reset().
+        size_t lastFrameBytesUsed = 0;
+
+        // Largest value lastFrameBytesUsed has had.
+        size_t peakBytesUsed = 0;
+
+        // Total size of all chunks, including the initial one.
+        size_t bytesReserved = 0;
+
+        // Number of times a chunk was added because the ones available
+        // were full.
+        int chunksAdded = 0;
+    };
+
+    explicit RegionAllocator(size_t chunkSize)
+        :	fChunkSize(chunkSize)
+    {
+        fFirstChunk = createChunk(chunkSize);
+        fCurrentChunk = fFirstChunk;
+        fNextAlloc = fFirstChunk->data;
     }
 
     RegionAllocator(const RegionAllocator&) = delete;
@@ -47,23 +70,39 @@ public:
 
     ~RegionAllocator()
     {
-        delete [] fArenaBase;
+        freeChunkList(fFirstChunk);
+        freeChunkList(fFreeChunks);
     }
 
-    // This is reentrant and lock-free. Alignment must be a power of 2
+    // This is reentrant and lock-free unless it needs to add a chunk.
+    // Alignment must be a power of 2
     void *alloc(size_t size, size_t alignment = 4)
     {
         char *nextAlloc;
         char *alignedAlloc;
 
-        do
+        while (true)
         {
+            // When a new chunk is added, the last thing it does is update
+            // fNextAlloc. Read that *first* so we don't get a stale value for
+            // fCurrentChunk. If fNextAlloc is not in the chunk, it changed
+            // between the two reads, so retry.
             nextAlloc = fNextAlloc;
-            alignedAlloc = reinterpret_cast<char*>((reinterpret_cast<unsigned int>(nextAlloc)
+            Chunk *chunk = fCurrentChunk;
+            if (nextAlloc < chunk->data || nextAlloc > chunk->data + chunk->size)
+                continue;
+
+            alignedAlloc = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(nextAlloc)
                                                     + alignment - 1) & ~(alignment - 1));
-            assert(alignedAlloc + size < fArenaBase + fTotalSize);
+            if (alignedAlloc + size > chunk->data + chunk->size)
+            {
+                addChunk(chunk, size + alignment);
+                continue;
+            }
+
+            if (__sync_bool_compare_and_swap(&fNextAlloc, nextAlloc, alignedAlloc + size))
+                break;
         }
-        while (!__sync_bool_compare_and_swap(&fNextAlloc, nextAlloc, alignedAlloc + size));
 
         return alignedAlloc;
     }
@@ -72,18 +111,132 @@ public:
     // are calling other methods on the allocator when this is called
     void reset()
     {
-        fNextAlloc = fArenaBase;
+        fStats.lastFrameBytesUsed = bytesUsed();
+        if (fStats.lastFrameBytesUsed > fStats.peakBytesUsed)
+            fStats.peakBytesUsed = fStats.lastFrameBytesUsed;
+
+        // Keep the first chunk and put the others on the free list.
+        if (fFirstChunk->next)
+        {
+            Chunk *lastChunk = fFirstChunk->next;
+            while (lastChunk->next)
+                lastChunk = lastChunk->next;
+
+            lastChunk->next = fFreeChunks;
+            fFreeChunks = fFirstChunk->next;
+            fFirstChunk->next = nullptr;
+        }
+
+        fCurrentChunk = fFirstChunk;
+        fNextAlloc = fFirstChunk->data;
+        fFilledChunkBytes = 0;
     }
 
+    // Number of bytes allocated since the last reset, not including space
+    // wasted at the end of filled chunks. This is not thread safe.
     size_t bytesUsed() const
     {
-        return static_cast<size_t>(fNextAlloc - fArenaBase);
+        return fFilledChunkBytes + static_cast<size_t>(fNextAlloc - fCurrentChunk->data);
+    }
+
+    const Stats &getStats() const
+    {
+        return fStats;
     }
 
 private:
-    char *fArenaBase;
-    unsigned int fTotalSize;
+    struct Chunk
+    {
+        Chunk *next;
+        size_t size;
+        char *data;
+    };
+
+    Chunk *createChunk(size_t size)
+    {
+        char *memory = new char[sizeof(Chunk) + size];
+        Chunk *chunk = reinterpret_cast<Chunk*>(memory);
+        chunk->next = nullptr;
+        chunk->size = size;
+        chunk->data = memory + sizeof(Chunk);
+        fStats.bytesReserved += size;
+        return chunk;
+    }
+
+    void freeChunkList(Chunk *chunk)
+    {
+        while (chunk)
+        {
+            Chunk *next = chunk->next;
+            delete [] reinterpret_cast<char*>(chunk);
+            chunk = next;
+        }
+    }
+
+    // Make a chunk with at least minSize bytes the current one, unless
+    // another thread already replaced fullChunk.
+    void addChunk(Chunk *fullChunk, size_t minSize)
+    {
+        // Acquire spinlock. See CommandQueue::allocateBucket.
+        do
+        {
+            while (fSpinLock)
+                ;
+        }
+        while (!__sync_bool_compare_and_swap(&fSpinLock, 0, 1));
+
+        if (fCurrentChunk == fullChunk)
+        {
+            // Reuse a chunk from a previous frame if there is one large
+            // enough. Otherwise, create a new one.
+            Chunk *newChunk = nullptr;
+            for (Chunk **link = &fFreeChunks; *link; link = &(*link)->next)
+            {
+                if ((*link)->size >= minSize)
+                {
+                    newChunk = *link;
+                    *link = newChunk->next;
+                    newChunk->next = nullptr;
+                    break;
+                }
+            }
+
+            if (newChunk == nullptr)
+            {
+                newChunk = createChunk(minSize > fChunkSize ? minSize : fChunkSize);
+                fStats.chunksAdded++;
+            }
+
+            fullChunk->next = newChunk;
+
+            // We must update fNextAlloc after fCurrentChunk to avoid a race
+            // condition with alloc.  Because they are volatile, the compiler
+            // won't reorder them. Other threads may still be allocating from
+            // the end of the old chunk, so swap atomically to determine how much
+            // of it was used.
+            fCurrentChunk = newChunk;
+            char *oldNextAlloc;
+            do
+            {
+                oldNextAlloc = fNextAlloc;
+            }
+            while (!__sync_bool_compare_and_swap(&fNextAlloc, oldNextAlloc, newChunk->data));
+
+            fFilledChunkBytes += static_cast<size_t>(oldNextAlloc - fullChunk->data);
+        }
+
+        fSpinLock = 0;
+        __sync_synchronize();
+    }
+
+    size_t fChunkSize;
+    Chunk *fFirstChunk;
+    Chunk *fFreeChunks = nullptr;
+    Chunk * volatile fCurrentChunk;
     char * volatile fNextAlloc;
+    size_t fFilledChunkBytes = 0;
+    volatile int fSpinLock = 0;
+    Stats fStats;
 };
 
 } // namespace librender
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "SIMDMath.h"
@@ -23,18 +24,54 @@
 namespace librender
 {
 
+// Storage formats for attributes. Attributes are returned to shaders as
+// 32-bit values: the float formats are converted to 32-bit floats, and
+// kAttribUint16 is zero extended to a 32-bit integer.
+enum AttribFormat
+{
+    kAttribFloat32,	// Also used for 32-bit integers, which are not converted
+    kAttribFloat16,	// IEEE half precision. Infinity and NaN aren't supported.
+    kAttribSnorm16,	// Signed -32767 to 32767, converted to -1.0 to 1.0
+    kAttribUnorm16,	// Unsigned 0 to 65535, converted to 0.0 to 1.0
+    kAttribUint16	// Unsigned integer, for example indices
+};
+
+inline int getAttribFormatSize(AttribFormat format)
+{
+    return format == kAttribFloat32 ? 4 : 2;
+}
+
 //
 // RenderBuffer is a wrapper for an array of geometric data like
 // vertex attributes or indices.
 //
+// Elements are normally interleaved: all attributes of the first element,
+// followed by all attributes of the second, and so on. In the planar layout
+// (structure of arrays), each attribute is stored in its own array
+// instead. Loading an attribute for 16 consecutive elements from a planar
+// buffer is a single block load rather than a gather, which accesses the
+// cache once for each lane.
+//
+// By default, each attribute is a 32-bit value. Buffers can also store
+// attributes in 16-bit formats, which halves the memory and bandwidth
+// they use. Gathers can only load aligned 32-bit words, so 16-bit values
+// are extracted from the word that contains them.
+//
 
 class RenderBuffer
 {
 public:
+    static const int kMaxAttribs = 16;
+
     RenderBuffer()
         :	fData(0),
             fNumElements(0),
             fStride(0),
+            fElementStride(0),
+            fAttribStride(kElementSize),
+            fPlanar(false),
+            fBlockLoads(false),
+            fHasFormats(false),
             fBaseStepPointers(static_cast<veci16_t*>(memalign(sizeof(vecu16_t), sizeof(vecu16_t))))
     {
     }
@@ -58,15 +95,80 @@ public:
     // a separate buffer.  The caller must ensure the memory remains around
     // as long as the RenderBuffer is active.
     // XXX should there be a concept of owned and not-owned data like Surface?
+    // Elements with a stride of two bytes are 16-bit integers, which can
+    // be used for index buffers with up to 65536 vertices.
     void setData(const void *data, int numElements, int stride)
     {
-        fData = data;
-        fNumElements = numElements;
-        fStride = stride;
+        if (stride == 2)
+        {
+            const AttribFormat kIndexFormat = kAttribUint16;
+            setData(data, numElements, stride, &kIndexFormat, 1);
+            return;
+        }
 
-        const veci16_t kStepVector = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
-        *fBaseStepPointers = kStepVector * fStride
-                             + reinterpret_cast<int>(fData);
+        setLayout(data, numElements, stride, stride, kElementSize, false);
+    }
+
+    // Interleaved data with the given format for each attribute. The
+    // attributes of an element are packed in order, and 32-bit attributes
+    // must be aligned to four bytes.
+    void setData(const void *data, int numElements, int stride, const AttribFormat *formats,
+                 int numAttribs)
+    {
+        assert(numAttribs <= kMaxAttribs);
+        setLayout(data, numElements, stride, stride, kElementSize, false);
+        fHasFormats = true;
+        int offset = 0;
+        for (int attrib = 0; attrib < numAttribs; attrib++)
+        {
+            assert(formats[attrib] != kAttribFloat32 || (offset & 3) == 0);
+            fAttribFormats[attrib] = formats[attrib];
+            fAttribOffsets[attrib] = offset;
+            fAttribElementStrides[attrib] = stride;
+            offset += getAttribFormatSize(formats[attrib]);
+        }
+
+        assert(offset <= stride);
+    }
+
+    // Use data in the planar layout, with numAttribs arrays of 32-bit
+    // values. Each array is padded to a multiple of 32 elements (see
+    // getPlanarPitch), so attribute n of element i is at index
+    // n * getPlanarPitch(numElements) + i. If data is aligned to a cache
+    // line, loadElements uses block loads. Like setData, this doesn't copy
+    // the data.
+    void setPlanarData(const void *data, int numElements, int numAttribs)
+    {
+        setLayout(data, numElements, numAttribs * kElementSize, kElementSize,
+                  getPlanarPitch(numElements) * kElementSize, true);
+    }
+
+    // Planar data with the given format for each attribute. The arrays
+    // are stored in order, and each is padded to getPlanarPitch elements.
+    // This keeps arrays of 16-bit values aligned to a cache line, so they
+    // can also be read with block loads.
+    void setPlanarData(const void *data, int numElements, const AttribFormat *formats,
+                       int numAttribs)
+    {
+        assert(numAttribs <= kMaxAttribs);
+        const int pitch = getPlanarPitch(numElements);
+        setLayout(data, numElements, 0, kElementSize, pitch * kElementSize, true);
+        fHasFormats = true;
+        int offset = 0;
+        for (int attrib = 0; attrib < numAttribs; attrib++)
+        {
+            const int size = getAttribFormatSize(formats[attrib]);
+            fAttribFormats[attrib] = formats[attrib];
+            fAttribOffsets[attrib] = offset;
+            fAttribElementStrides[attrib] = size;
+            offset += pitch * size;
+            fStride += size;
+        }
+    }
+
+    static int getPlanarPitch(int numElements)
+    {
+        return (numElements + 31) & ~31;
     }
 
     int getNumElements() const
@@ -74,14 +176,17 @@ public:
         return fNumElements;
     }
 
+    // Size of all attributes of one element, in bytes. For the interleaved
+    // layout, this is also the distance between elements.
     int getStride() const
     {
         return fStride;
     }
 
+    // Size of the data, in bytes, including padding for the planar layout.
     int getSize() const
     {
-        return fNumElements * fStride;
+        return (fPlanar ? getPlanarPitch(fNumElements) : fNumElements) * fStride;
     }
 
     const void *getData() const
@@ -94,26 +199,132 @@ public:
     // Return up to 16 elements packed in a vector: a_mb_n, a_mb_(n+1)...
     vecu16_t gatherElements(int baseIndex, int paramNum, vmask_t mask) const
     {
-        const veci16_t ptrVec = *fBaseStepPointers + baseIndex * fStride
-                                + paramNum * kElementSize;
+        if (fHasFormats)
+        {
+            const veci16_t kStepVector = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+            return gatherElements(kStepVector + baseIndex, paramNum, mask);
+        }
+
+        const veci16_t ptrVec = *fBaseStepPointers + baseIndex * fElementStride
+                                + paramNum * fAttribStride;
         return __builtin_nyuzi_gather_loadf_masked(ptrVec, mask);
     }
 
     // Load up to 16 parameters with arbitrary indices.
     vecu16_t gatherElements(veci16_t indices, int paramNum, vmask_t mask) const
     {
-        const veci16_t ptrVec = indices * fStride + paramNum * kElementSize
-                                + reinterpret_cast<int>(fData);
+        if (fHasFormats)
+        {
+            const veci16_t ptrVec = indices * fAttribElementStrides[paramNum]
+                                    + fAttribOffsets[paramNum] + ptrToInt(fData);
+            if (fAttribFormats[paramNum] == kAttribFloat32)
+                return __builtin_nyuzi_gather_loadf_masked(ptrVec, mask);
+
+            // Load the word that contains each value and shift it down.
+            const vecu16_t words = vecu16_t(__builtin_nyuzi_gather_loadi_masked(ptrVec & ~3,
+                                            mask));
+            return decode16(words >> vecu16_t((ptrVec & 2) << 3), fAttribFormats[paramNum]);
+        }
+
+        const veci16_t ptrVec = indices * fElementStride + paramNum * fAttribStride
+                                + ptrToInt(fData);
 
         return __builtin_nyuzi_gather_loadf_masked(ptrVec, mask);
     }
 
+    // Same as gatherElements with contiguous indices, but baseIndex must be
+    // a multiple of 16. For aligned planar buffers, this loads all lanes
+    // with one block load. Lanes that are not set in mask read padding.
+    vecu16_t loadElements(int baseIndex, int paramNum, vmask_t mask) const
+    {
+        if (!fBlockLoads)
+            return gatherElements(baseIndex, paramNum, mask);
+
+        if (!fHasFormats)
+        {
+            return *reinterpret_cast<const vecu16_t*>(static_cast<const char*>(fData)
+                    + paramNum * fAttribStride + baseIndex * kElementSize);
+        }
+
+        const char *array = static_cast<const char*>(fData) + fAttribOffsets[paramNum];
+        if (fAttribFormats[paramNum] == kAttribFloat32)
+            return *reinterpret_cast<const vecu16_t*>(array + baseIndex * kElementSize);
+
+        // A cache line holds 32 16-bit values. Load the line that contains
+        // these 16, and move the word with each lane's value into it.
+        const vecu16_t line = *reinterpret_cast<const vecu16_t*>(array + ((baseIndex * 2) & ~63));
+        const veci16_t kHalfWordIndex = { 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7 };
+        const vecu16_t kHalfWordShift = { 0, 16, 0, 16, 0, 16, 0, 16, 0, 16, 0, 16, 0, 16, 0, 16 };
+        const vecu16_t words = vecu16_t(__builtin_nyuzi_shufflei(veci16_t(line),
+                                        kHalfWordIndex + ((baseIndex & 16) >> 1)));
+        return decode16(words >> kHalfWordShift, fAttribFormats[paramNum]);
+    }
+
 private:
-    const int kElementSize = 4;
+    static const int kElementSize = 4;
+
+    // Convert 16-bit values in the low half of each lane.
+    static vecu16_t decode16(vecu16_t values, AttribFormat format)
+    {
+        values &= 0xffff;
+        switch (format)
+        {
+        case kAttribFloat16:
+        {
+            // Shift the exponent and mantissa into place, then multiply by
+            // 2^112 to rebias the exponent. This also converts denormals.
+            const vecf16_t kRebias = vecf16_t(vecu16_t(0x77800000));
+            const vecf16_t magnitude = vecf16_t((values & 0x7fff) << 13) * kRebias;
+            return vecu16_t(magnitude) | ((values & 0x8000) << 16);
+        }
+
+        case kAttribSnorm16:
+        {
+            const veci16_t signedValues = veci16_t(values << 16) >> 16;
+            return vecu16_t(max(__builtin_convertvector(signedValues, vecf16_t)
+                                * (1.0f / 32767.0f), vecf16_t(-1.0f)));
+        }
+
+        case kAttribUnorm16:
+            return vecu16_t(__builtin_convertvector(values, vecf16_t) * (1.0f / 65535.0f));
+
+        default:
+            return values;
+        }
+    }
+
+    void setLayout(const void *data, int numElements, int stride, int elementStride,
+                   int attribStride, bool planar)
+    {
+        fData = data;
+        fNumElements = numElements;
+        fStride = stride;
+        fElementStride = elementStride;
+        fAttribStride = attribStride;
+        fPlanar = planar;
+        fBlockLoads = planar
+                      && (reinterpret_cast<uintptr_t>(data) & (sizeof(vecu16_t) - 1)) == 0;
+        fHasFormats = false;
+
+        const veci16_t kStepVector = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+        *fBaseStepPointers = kStepVector * fElementStride
+                             + ptrToInt(fData);
+    }
 
     const void *fData;
     int fNumElements;
     int fStride;
+    int fElementStride;	// Bytes between consecutive elements of one attribute
+    int fAttribStride;	// Bytes between attributes of one element
+    bool fPlanar;
+    bool fBlockLoads;
+
+    // Set if attributes have formats other than 32-bit, in which case
+    // these describe each attribute.
+    bool fHasFormats;
+    AttribFormat fAttribFormats[kMaxAttribs];
+    int fAttribOffsets[kMaxAttribs];
+    int fAttribElementStrides[kMaxAttribs];
 
     veci16_t *fBaseStepPointers;
 };
@@ -14,6 +14,8 @@
 // limitations under the License.
 //
 
+#include <assert.h>
+#include <nyuzi.h>
 #include <schedule.h>
 #include <string.h>
 #include "line.h"
@@ -25,6 +27,39 @@
 namespace librender
 {
 
+namespace
+{
+
+const float kNearWClip = 1.0;
+
+// Value for the farthest depth: -infinity, or 0 for 16-bit depth buffers,
+// which store -1/z.
+unsigned int depthClearValue(const Surface *depthBuffer)
+{
+    return depthBuffer->getFormat() == kR16 ? 0 : 0xff800000;
+}
+
+// Split indices into a range that is repeated for each instance into the
+// instance number and the index within the instance. This uses a float
+// reciprocal, because there is no vector integer divide, then corrects
+// lanes where rounding put the result one off.
+veci16_t splitInstanceIndex(veci16_t index, int perInstance, veci16_t *outInstance)
+{
+    veci16_t instance = __builtin_convertvector(__builtin_convertvector(index, vecf16_t)
+                        * (1.0f / perInstance), veci16_t);
+    veci16_t local = index - instance * perInstance;
+    const vmask_t tooLow = __builtin_nyuzi_mask_cmpi_slt(local, veci16_t(0));
+    instance = __builtin_nyuzi_vector_mixi(tooLow, instance - 1, instance);
+    local = __builtin_nyuzi_vector_mixi(tooLow, local + perInstance, local);
+    const vmask_t tooHigh = __builtin_nyuzi_mask_cmpi_sge(local, veci16_t(perInstance));
+    instance = __builtin_nyuzi_vector_mixi(tooHigh, instance + 1, instance);
+    local = __builtin_nyuzi_vector_mixi(tooHigh, local - perInstance, local);
+    *outInstance = instance;
+    return local;
+}
+
+} // namespace
+
 RenderContext::RenderContext(size_t workingMemSize)
     : 	fClearColorBuffer(false),
        fAllocator(workingMemSize)
@@ -32,14 +67,26 @@ RenderContext::RenderContext(size_t workingMemSize)
     fDrawQueue.setAllocator(&fAllocator);
 }
 
-void RenderContext::setClearColor(float r, float g, float b)
+RenderContext::~RenderContext()
 {
-    r = max(min(r, 1.0f), 0.0f);
-    g = max(min(g, 1.0f), 0.0f);
-    b = max(min(b, 1.0f), 0.0f);
+    for (RenderState &state : fDrawQueue)
+    {
+        if (state.fUniformBuffer)
+            state.fUniformBuffer->release();
+    }
+
+    if (fCurrentState.fUniformBuffer)
+        fCurrentState.fUniformBuffer->release();
 
-    fClearColor = 0xff000000 | (unsigned(b * 255.0) << 16) | (unsigned(g * 255.0) << 8)
-                  | unsigned(r * 255.0);
+    delete [] fTileTriangles;
+    delete [] fTileFillCycles;
+}
+
+void RenderContext::setClearColor(float r, float g, float b)
+{
+    fClearColor[0] = max(min(r, 1.0f), 0.0f);
+    fClearColor[1] = max(min(g, 1.0f), 0.0f);
+    fClearColor[2] = max(min(b, 1.0f), 0.0f);
 }
 
 void RenderContext::bindVertexAttrs(const RenderBuffer *vertexAttrs)
@@ -49,18 +96,72 @@ void RenderContext::bindVertexAttrs(const RenderBuffer *vertexAttrs)
 
 void RenderContext::bindUniforms(const void *uniforms, size_t size)
 {
+    if (fCurrentState.fUniformBuffer)
+    {
+        fCurrentState.fUniformBuffer->release();
+        fCurrentState.fUniformBuffer = nullptr;
+    }
+
     void *uniformCopy = fAllocator.alloc(size);
     ::memcpy(uniformCopy, uniforms, size);
     fCurrentState.fUniforms = uniformCopy;
 }
 
+void RenderContext::bindUniforms(UniformBuffer *buffer)
+{
+    buffer->addRef();
+    if (fCurrentState.fUniformBuffer)
+        fCurrentState.fUniformBuffer->release();
+
+    fCurrentState.fUniformBuffer = buffer;
+    fCurrentState.fUniforms = buffer->getData();
+}
+
 void RenderContext::bindTarget(RenderTarget *target)
 {
     fRenderTarget = target;
-    fFbWidth = fRenderTarget->getColorBuffer()->getWidth();
-    fFbHeight = fRenderTarget->getColorBuffer()->getHeight();
-    fTileColumns = (fFbWidth + kTileSize - 1) / kTileSize;
-    fTileRows = (fFbHeight + kTileSize - 1) / kTileSize;
+
+    // A target may have only a depth buffer, for example a shadow map.
+    const Surface *surface = target->getColorBuffer() ? target->getColorBuffer()
+                             : target->getDepthBuffer();
+    assert(surface != nullptr);
+    fFbWidth = surface->getWidth();
+    fFbHeight = surface->getHeight();
+    fTileColumns = (fFbWidth + fTileSize - 1) >> fTileSizeBits;
+    fTileRows = (fFbHeight + fTileSize - 1) >> fTileSizeBits;
+    trackClearState();
+
+    // Express the guard band as a multiple of the view volume so it can be
+    // compared directly against clip space coordinates.
+    fGuardBandX = static_cast<float>(kGuardBandPixels) / (fFbWidth / 2);
+    fGuardBandY = static_cast<float>(kGuardBandPixels) / (fFbHeight / 2);
+}
+
+// The clear state is only valid for the surfaces and tile size it was
+// recorded with. Anything else may have written to a surface while it wasn't
+// bound, so the state is discarded when the bound surfaces change.
+void RenderContext::trackClearState()
+{
+    const int numTiles = fTileColumns * fTileRows;
+    fColorClearState.track(fRenderTarget->getColorBuffer(), fTileSize, numTiles);
+    fDepthClearState.track(fRenderTarget->getDepthBuffer(), fTileSize, numTiles);
+}
+
+// Initialize a depth buffer tile before drawing triangles into it.
+void RenderContext::clearDepthTile(int index, int tileX, int tileY)
+{
+    Surface *depthBuffer = fRenderTarget->getDepthBuffer();
+    depthBuffer->clearTile(tileX, tileY, depthClearValue(depthBuffer));
+    fDepthClearState.setDirty(index);
+}
+
+void RenderContext::setTileSize(int size)
+{
+    assert(size == 32 || size == 64 || size == 128);
+    fTileSize = size;
+    fTileSizeBits = __builtin_ctz(static_cast<unsigned int>(size));
+    fTileColumns = (fFbWidth + fTileSize - 1) >> fTileSizeBits;
+    fTileRows = (fFbHeight + fTileSize - 1) >> fTileSizeBits;
 }
 
 void RenderContext::bindShader(Shader *shader)
@@ -72,17 +173,84 @@ void RenderContext::bindShader(Shader *shader)
 void RenderContext::drawElements(const RenderBuffer *indices)
 {
     fCurrentState.fIndexBuffer = indices;
+    fCurrentState.fInstanceData = nullptr;
+    fCurrentState.fInstanceCount = 1;
+    queueDrawCommand();
+}
+
+void RenderContext::drawElementsInstanced(const RenderBuffer *indices, int instanceCount,
+                                          const RenderBuffer *instanceData)
+{
+    if (instanceCount <= 0)
+        return;
+
+    assert(instanceData != nullptr);
+    assert(fCurrentState.fShader != nullptr);
+    assert(instanceData->getNumElements() >= instanceCount);
+    assert(instanceData->getStride() >= fCurrentState.fShader->getNumInstanceAttribs()
+           * static_cast<int>(sizeof(float)));
+    fCurrentState.fIndexBuffer = indices;
+    fCurrentState.fInstanceData = instanceData;
+    fCurrentState.fInstanceCount = instanceCount;
+    queueDrawCommand();
+}
+
+void RenderContext::queueDrawCommand()
+{
+    // Keep the uniform buffer until this command has been rendered.
+    if (fCurrentState.fUniformBuffer)
+        fCurrentState.fUniformBuffer->addRef();
+
     fDrawQueue.append(fCurrentState);
 }
 
+bool RenderContext::drawElements(const RenderBuffer *indices, const Matrix &mvpMatrix,
+                                 const Vec3 &boundsMin, const Vec3 &boundsMax)
+{
+    // Transform the corners of the box to clip space, one in each of the
+    // first eight lanes.
+    const veci16_t kCornerIndex = { 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7 };
+    vecf16_t corners[4];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const vmask_t useMax = __builtin_nyuzi_mask_cmpi_ne(kCornerIndex & (1 << axis),
+                               veci16_t(0));
+        corners[axis] = __builtin_nyuzi_vector_mixf(useMax, vecf16_t(boundsMax[axis]),
+                        vecf16_t(boundsMin[axis]));
+    }
+
+    corners[3] = 1.0f;
+    vecf16_t clip[4];
+    mvpMatrix.mulVec(clip, corners);
+
+    // The box is outside the frustum if all corners are outside the same
+    // plane. Like triangle setup, there is no far plane.
+    const vecf16_t &x = clip[kParamX];
+    const vecf16_t &y = clip[kParamY];
+    const vecf16_t &w = clip[kParamW];
+    const vmask_t kCornerMask = 0xff;
+    if ((__builtin_nyuzi_mask_cmpf_lt(w, vecf16_t(kNearWClip)) & kCornerMask) == kCornerMask
+            || (__builtin_nyuzi_mask_cmpf_gt(x, w) & kCornerMask) == kCornerMask
+            || (__builtin_nyuzi_mask_cmpf_lt(x, -w) & kCornerMask) == kCornerMask
+            || (__builtin_nyuzi_mask_cmpf_gt(y, w) & kCornerMask) == kCornerMask
+            || (__builtin_nyuzi_mask_cmpf_lt(y, -w) & kCornerMask) == kCornerMask)
+    {
+        fDrawCallsCulled++;
+        return false;
+    }
+
+    drawElements(indices);
+    return true;
+}
+
 void RenderContext::_shadeVertices(void *_castToContext, int index)
 {
     static_cast<RenderContext*>(_castToContext)->shadeVertices(index);
 }
 
-void RenderContext::_setUpTriangle(void *_castToContext, int index)
+void RenderContext::_setUpTriangles(void *_castToContext, int index)
 {
-    static_cast<RenderContext*>(_castToContext)->setUpTriangle(index);
+    static_cast<RenderContext*>(_castToContext)->setUpTriangles(index);
 }
 
 void RenderContext::_fillTile(void *_castToContext, int index)
@@ -90,6 +258,11 @@ void RenderContext::_fillTile(void *_castToContext, int index)
     static_cast<RenderContext*>(_castToContext)->fillTile(index);
 }
 
+void RenderContext::_fillDepthTile(void *_castToContext, int index)
+{
+    static_cast<RenderContext*>(_castToContext)->fillDepthTile(index);
+}
+
 void RenderContext::_wireframeTile(void *_castToContext, int index)
 {
     static_cast<RenderContext*>(_castToContext)->wireframeTile(index);
@@ -97,51 +270,113 @@ void RenderContext::_wireframeTile(void *_castToContext, int index)
 
 void RenderContext::finish()
 {
+    // The tile size may have changed, or different surfaces may have been
+    // put in the target, since it was bound.
+    if (fRenderTarget->getColorBuffer())
+        fRenderTarget->getColorBuffer()->setTileSize(fTileSize);
+
+    if (fRenderTarget->getDepthBuffer())
+        fRenderTarget->getDepthBuffer()->setTileSize(fTileSize);
+
+    trackClearState();
+
     int kMaxTiles = fTileColumns * fTileRows;
     fTiles = new (fAllocator) TriangleArray[kMaxTiles];
     for (int i = 0; i < kMaxTiles; i++)
         fTiles[i].setAllocator(&fAllocator);
 
+    fStats.reset();
+    fStats.drawCallsCulled = fDrawCallsCulled;
+    fDrawCallsCulled = 0;
+    if (kMaxTiles > fStatsTileCapacity)
+    {
+        delete [] fTileTriangles;
+        delete [] fTileFillCycles;
+        fTileTriangles = new int[kMaxTiles];
+        fTileFillCycles = new unsigned int[kMaxTiles];
+        fStatsTileCapacity = kMaxTiles;
+    }
+
+    fStats.numTiles = kMaxTiles;
+    fStats.tileTriangles = fTileTriangles;
+    fStats.tileFillCycles = fTileFillCycles;
+
     // Geometry phase.  Walk through each draw command and perform two steps
     // for each one:
     // 1. Call vertex shader on attributes (shadeVertices)
-    // 2. Perform triangle setup and binning (setUpTriangle)
+    // 2. Perform triangle setup and binning (setUpTriangles)
     fBaseSequenceNumber = 0;
     for (fRenderCommandIterator = fDrawQueue.begin(); fRenderCommandIterator != fDrawQueue.end();
             ++fRenderCommandIterator)
     {
         RenderState &state = *fRenderCommandIterator;
-        int numVertices = state.fVertexAttrBuffer->getNumElements();
-        int numTriangles = state.fIndexBuffer->getNumElements() / 3;
+        int numVertices = state.fVertexAttrBuffer->getNumElements() * state.fInstanceCount;
+        int numTriangles = state.fIndexBuffer->getNumElements() / 3 * state.fInstanceCount;
         state.fVertexParams = static_cast<float*>(fAllocator.alloc(
                                   static_cast<unsigned int>(numVertices)
                                   * static_cast<unsigned int>(state.fShader->getNumParams())
                                   * sizeof(int)));
+        startPhase();
         parallel_execute(_shadeVertices, this, (numVertices + 15) / 16);
-        parallel_execute(_setUpTriangle, this, numTriangles);
+        endPhase(RenderStats::kVertexShading);
+        startPhase();
+        parallel_execute(_setUpTriangles, this, (numTriangles + 15) / 16);
+        endPhase(RenderStats::kTriangleSetup);
         fBaseSequenceNumber += numTriangles;
+        fStats.drawCalls++;
     }
 
     // Pixel phase.  Shade the pixels and write back.
-    if (fWireframeMode)
+    startPhase();
+    if (!fRenderTarget->getColorBuffer())
+        parallel_execute(_fillDepthTile, this, fTileColumns * fTileRows);
+    else if (fWireframeMode)
         parallel_execute(_wireframeTile, this, fTileColumns * fTileRows);
     else
         parallel_execute(_fillTile, this, fTileColumns * fTileRows);
 
-#if DISPLAY_STATS
-    printf("total triangles = %d\n", fBaseSequenceNumber);
-    printf("used %zu bytes\n", fAllocator.bytesUsed());
-#endif
+    endPhase(RenderStats::kPixelFill);
+
+    for (RenderState &state : fDrawQueue)
+    {
+        if (state.fUniformBuffer)
+            state.fUniformBuffer->release();
+    }
 
     // Clean up memory
     // First reset draw queue to clean up, then allocator, which frees
     // memory it is using.
     fDrawQueue.reset();
     fAllocator.reset();
-    fCurrentState.fUniforms = nullptr;	// Remove dangling pointer
+    if (!fCurrentState.fUniformBuffer)
+        fCurrentState.fUniforms = nullptr;	// Remove dangling pointer
     fClearColorBuffer = false;
 }
 
+void RenderContext::startPhase()
+{
+    if (fPerfCounterStats)
+    {
+        for (int counter = 0; counter < NUM_COUNTERS; counter++)
+            fPhaseStartCounters[counter] = read_perf_counter(counter);
+    }
+
+    fPhaseStartCycles = get_cycle_count();
+}
+
+void RenderContext::endPhase(RenderStats::Phase phase)
+{
+    fStats.phaseCycles[phase] += get_cycle_count() - fPhaseStartCycles;
+    if (fPerfCounterStats)
+    {
+        for (int counter = 0; counter < NUM_COUNTERS; counter++)
+        {
+            fStats.phasePerfCounters[phase][counter] += read_perf_counter(counter)
+                    - fPhaseStartCounters[counter];
+        }
+    }
+}
+
 //
 // Compute vertex parameters.  This shades all vertices in the attribute array,
 // even if they are not referenced by the index array.
@@ -149,7 +384,8 @@ void RenderContext::finish()
 void RenderContext::shadeVertices(int index)
 {
     const RenderState &state = *fRenderCommandIterator;
-    int numVertices = state.fVertexAttrBuffer->getNumElements() - index * 16;
+    const int verticesPerInstance = state.fVertexAttrBuffer->getNumElements();
+    int numVertices = verticesPerInstance * state.fInstanceCount - index * 16;
     vmask_t mask;
     if (numVertices < 16)
         mask = (1 << numVertices) - 1;
@@ -157,12 +393,38 @@ void RenderContext::shadeVertices(int index)
         mask = 0xffff;
 
     int attribsPerVertex = state.fShader->getNumAttribs();
-    vecf16_t packedAttribs[attribsPerVertex];
+    int attribsPerInstance = state.fInstanceData ? state.fShader->getNumInstanceAttribs() : 0;
+    vecf16_t packedAttribs[attribsPerVertex + attribsPerInstance];
     int startIndex = index * 16;
-    for (int attrib = 0; attrib < attribsPerVertex; attrib++)
+    if (state.fInstanceData)
+    {
+        // Vertex parameters for all instances are stored consecutively, so
+        // a batch may span more than one instance.
+        const veci16_t kStepVector = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+        veci16_t instance;
+        const veci16_t vertexIndex = splitInstanceIndex(kStepVector + startIndex,
+                                     verticesPerInstance, &instance);
+        for (int attrib = 0; attrib < attribsPerVertex; attrib++)
+        {
+            packedAttribs[attrib] = vecf16_t(state.fVertexAttrBuffer->gatherElements(vertexIndex,
+                                             attrib, mask));
+        }
+
+        for (int attrib = 0; attrib < attribsPerInstance; attrib++)
+        {
+            packedAttribs[attribsPerVertex + attrib] = vecf16_t(
+                        state.fInstanceData->gatherElements(instance, attrib, mask));
+        }
+    }
+    else
     {
-        packedAttribs[attrib] = vecf16_t(state.fVertexAttrBuffer->gatherElements(startIndex,
-                                         attrib, mask));
+        // startIndex is a multiple of 16, so this can use block loads if
+        // the buffer is planar.
+        for (int attrib = 0; attrib < attribsPerVertex; attrib++)
+        {
+            packedAttribs[attrib] = vecf16_t(state.fVertexAttrBuffer->loadElements(startIndex,
+                                             attrib, mask));
+        }
     }
 
     int paramsPerVertex = state.fShader->getNumParams();
@@ -172,7 +434,7 @@ void RenderContext::shadeVertices(int index)
     const veci16_t kStepVector = { 0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 40, 44, 48, 52, 56, 60 };
     const veci16_t paramStepVector = kStepVector * paramsPerVertex;
     float *outBuf = state.fVertexParams + paramsPerVertex * index * 16;
-    veci16_t paramPtr = paramStepVector + reinterpret_cast<int>(outBuf);
+    veci16_t paramPtr = paramStepVector + ptrToInt(outBuf);
     for (int param = 0; param < paramsPerVertex; param++)
     {
         __builtin_nyuzi_scatter_storef_masked(paramPtr, packedParams[param], mask);
@@ -183,7 +445,10 @@ void RenderContext::shadeVertices(int index)
 namespace
 {
 
-const float kNearWClip = 1.0;
+const int kMaxClipPlanes = 5;
+
+// Each clip plane can add at most one vertex to the polygon.
+const int kMaxClipVertices = 3 + kMaxClipPlanes;
 
 void interpolate(float *outParams, const float *inParams0, const float *inParams1, int numParams,
                  float distance)
@@ -195,127 +460,278 @@ void interpolate(float *outParams, const float *inParams0, const float *inParams
 } // namespace
 
 //
-// Clip a triangle where one vertex is past the near clip plane.
-// The clipped vertex is always params0.  This creates two new triangles above
-// the clip plane.
-//
-//    1 +-------+ 2
-//      | \    /
-//      |   \ /
-//  np1 +----+ np2
-//      |.../
-//      |../    clipped
-//      |./
-//      |/
-//      0
+// Clip a triangle against the near plane and the guard band, then enqueue
+// the resulting polygon as a triangle fan. Returns the number of triangles
+// that were binned. This works in homogeneous
+// coordinates (before perspective division) using Sutherland-Hodgman
+// clipping. Each plane is described by the signed distance function
+// plane[0] * x + plane[1] * y + plane[2] * w + plane[3], which is
+// non-negative for points inside it. This path is only taken for triangles
+// that cross the near plane or extend past the guard band; the rasterizer
+// handles portions that are off screen but inside the guard band.
+// XXX the viewing volume is zNear = -1, zFar = -inf, so there is no far plane.
 //
 
-void RenderContext::clipOne(int sequence, const RenderState &state, const float *params0,
-                            const float *params1, const float *params2)
+int RenderContext::clipTriangle(int sequence, const RenderState &state, const float *params0,
+                                const float *params1, const float *params2)
 {
-    float newPoint1[kMaxParams];
-    float newPoint2[kMaxParams];
-
-    interpolate(newPoint1, params1, params0, state.fParamsPerVertex, (params1[kParamW] - kNearWClip)
-                / (params1[kParamW] - params0[kParamW]));
-    interpolate(newPoint2, params2, params0, state.fParamsPerVertex, (params2[kParamW] - kNearWClip)
-                / (params2[kParamW] - params0[kParamW]));
-    enqueueTriangle(sequence, state, newPoint1, params1, newPoint2);
-    enqueueTriangle(sequence, state, newPoint2, params1, params2);
-}
-
-//
-// Clip a triangle where two vertices are past the near clip plane.
-// The clipped vertices are always param0 and params1. Adjust the
-// bottom two points of the triangle.
-//
-//                 2
-//                 +
-//               / |
-//              /  |
-//             /   |
-//        np1 +----+ np2
-//           /.....|
-//          /......|  clipped
-//         /.......|
-//        +--------+
-//        1        0
-//
+    const float planes[kMaxClipPlanes][4] = {
+        { 0.0f, 0.0f, 1.0f, -kNearWClip },  // Near
+        { 1.0f, 0.0f, fGuardBandX, 0.0f },  // Left
+        { -1.0f, 0.0f, fGuardBandX, 0.0f }, // Right
+        { 0.0f, 1.0f, fGuardBandY, 0.0f },  // Bottom
+        { 0.0f, -1.0f, fGuardBandY, 0.0f }  // Top
+    };
+
+    float newVertices[kMaxClipPlanes * 2][kMaxParams];
+    int numNewVertices = 0;
+    const float *polygon[2][kMaxClipVertices] = {{ params0, params1, params2 }};
+    int numVertices = 3;
+    int current = 0;
+
+    for (int planeIndex = 0; planeIndex < kMaxClipPlanes && numVertices >= 3; planeIndex++)
+    {
+        const float *plane = planes[planeIndex];
+        const float * const *in = polygon[current];
+        const float **out = polygon[current ^ 1];
+        int numOut = 0;
+
+        const float *prev = in[numVertices - 1];
+        float prevDist = plane[0] * prev[kParamX] + plane[1] * prev[kParamY]
+                         + plane[2] * prev[kParamW] + plane[3];
+        for (int i = 0; i < numVertices; i++)
+        {
+            const float *vert = in[i];
+            const float dist = plane[0] * vert[kParamX] + plane[1] * vert[kParamY]
+                               + plane[2] * vert[kParamW] + plane[3];
+            if ((dist >= 0.0f) != (prevDist >= 0.0f))
+            {
+                // This edge crosses the plane. Create a new vertex at the
+                // intersection.
+                float *newVertex = newVertices[numNewVertices++];
+                interpolate(newVertex, prev, vert, state.fParamsPerVertex,
+                            prevDist / (prevDist - dist));
+                out[numOut++] = newVertex;
+            }
 
-void RenderContext::clipTwo(int sequence, const RenderState &state, const float *params0,
-                            const float *params1, const float *params2)
-{
-    float newPoint1[kMaxParams];
-    float newPoint2[kMaxParams];
+            if (dist >= 0.0f)
+                out[numOut++] = vert;
 
-    interpolate(newPoint1, params2, params1, state.fParamsPerVertex, (params2[kParamW] - kNearWClip)
-                / (params2[kParamW] - params1[kParamW]));
-    interpolate(newPoint2, params2, params0, state.fParamsPerVertex, (params2[kParamW] - kNearWClip)
-                / (params2[kParamW] - params0[kParamW]));
-    enqueueTriangle(sequence, state, newPoint2, newPoint1, params2);
-}
+            prev = vert;
+            prevDist = dist;
+        }
 
-void RenderContext::setUpTriangle(int triangleIndex)
-{
-    RenderState &state = *fRenderCommandIterator;
-    int vertexIndex = triangleIndex * 3;
-    const int *indices = static_cast<const int*>(state.fIndexBuffer->getData());
-    int offset0 = indices[vertexIndex] * state.fParamsPerVertex;
-    int offset1 = indices[vertexIndex + 1] * state.fParamsPerVertex;
-    int offset2 = indices[vertexIndex + 2] * state.fParamsPerVertex;
-    const float *params0 = &state.fVertexParams[offset0];
-    const float *params1 = &state.fVertexParams[offset1];
-    const float *params2 = &state.fVertexParams[offset2];
+        numVertices = numOut;
+        current ^= 1;
+    }
 
-    // Determine which point (if any) are clipped against the near plane, call
-    // appropriate clip routine with triangle rotated appropriately. We don't
-    // clip against other planes.
-    // XXX This is not quite correct; it needs to perform homogenous clipping.  Also,
-    // the viewing volume is zNear = -1, zFar = -inf
-    int clipMask = (params0[kParamW] < kNearWClip ? 1 : 0) | (params1[kParamW] < kNearWClip ? 2 : 0)
-                   | (params2[kParamW] < kNearWClip ? 4 : 0);
-    switch (clipMask)
+    // If the triangle was completely clipped, numVertices will be less than 3
+    // and this will not enqueue anything.
+    const float * const *clipped = polygon[current];
+    int numBinned = 0;
+    for (int i = 1; i < numVertices - 1; i++)
     {
-    case 0:
-        // Not clipped at all.
-        enqueueTriangle(fBaseSequenceNumber + triangleIndex, state,
-                        params0, params1, params2);
-        break;
+        if (enqueueTriangle(sequence, state, clipped[0], clipped[i], clipped[i + 1]))
+            numBinned++;
+    }
 
-    case 1:
-        clipOne(fBaseSequenceNumber + triangleIndex, state, params0, params1, params2);
-        break;
+    return numBinned;
+}
 
-    case 2:
-        clipOne(fBaseSequenceNumber + triangleIndex, state, params1, params2, params0);
-        break;
+//
+// Set up a batch of 16 triangles, one in each vector lane. This gathers the
+// indices and vertex positions, then performs clip classification, perspective
+// division, conversion to raster coordinates, backface culling, and bounding
+// box computation for all lanes at once.
+// Triangles that are entirely outside one of the frustum planes are rejected
+// before doing any other work. Triangles that cross the near plane or extend
+// past the guard band are rare, so they are set aside and handled by the
+// scalar clipping path. Everything else is passed to the rasterizer
+// unclipped.
+//
 
-    case 4:
-        clipOne(fBaseSequenceNumber + triangleIndex, state, params2, params0, params1);
-        break;
+void RenderContext::setUpTriangles(int batchIndex)
+{
+    const RenderState &state = *fRenderCommandIterator;
+    const int trianglesPerInstance = state.fIndexBuffer->getNumElements() / 3;
+    const int firstTriangle = batchIndex * 16;
+    const int numTriangles = trianglesPerInstance * state.fInstanceCount - firstTriangle;
+    const vmask_t batchMask = numTriangles < 16 ? (1 << numTriangles) - 1 : 0xffff;
+    const int sequenceBase = fBaseSequenceNumber + firstTriangle;
+
+    // Gather the positions of each triangle's vertices and compute outcodes.
+    // The outside masks start with all bits set and are ANDed with each vertex,
+    // so a bit remains set only if all three vertices are outside that plane.
+    // For instanced draws, the triangles in a batch may be from different
+    // instances, which index different ranges of the vertex parameters.
+    const veci16_t kTriangleStep = { 0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 33, 36, 39, 42, 45 };
+    const int paramStride = state.fParamsPerVertex * static_cast<int>(sizeof(float));
+    veci16_t firstIndex;
+    veci16_t vertexParamBase = ptrToInt(state.fVertexParams);
+    if (state.fInstanceCount > 1)
+    {
+        const veci16_t kStepVector = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+        veci16_t instance;
+        firstIndex = splitInstanceIndex(kStepVector + firstTriangle, trianglesPerInstance,
+                                        &instance) * 3;
+        vertexParamBase += instance * (state.fVertexAttrBuffer->getNumElements() * paramStride);
+    }
+    else
+        firstIndex = kTriangleStep + firstTriangle * 3;
+
+    veci16_t paramPtrs[3];
+    vecf16_t x[3];
+    vecf16_t y[3];
+    vecf16_t z[3];
+    vecf16_t w[3];
+    int outsideNear = 0xffff;
+    int outsideLeft = 0xffff;
+    int outsideRight = 0xffff;
+    int outsideBottom = 0xffff;
+    int outsideTop = 0xffff;
+    int needsClip = 0;
+    for (int vertex = 0; vertex < 3; vertex++)
+    {
+        veci16_t vertexIndices = veci16_t(state.fIndexBuffer->gatherElements(firstIndex + vertex,
+                                          0, batchMask));
+        paramPtrs[vertex] = vertexIndices * paramStride + vertexParamBase;
+        x[vertex] = __builtin_nyuzi_gather_loadf_masked(paramPtrs[vertex] + kParamX * 4, batchMask);
+        y[vertex] = __builtin_nyuzi_gather_loadf_masked(paramPtrs[vertex] + kParamY * 4, batchMask);
+        z[vertex] = __builtin_nyuzi_gather_loadf_masked(paramPtrs[vertex] + kParamZ * 4, batchMask);
+        w[vertex] = __builtin_nyuzi_gather_loadf_masked(paramPtrs[vertex] + kParamW * 4, batchMask);
+
+        const vmask_t nearClipped = __builtin_nyuzi_mask_cmpf_lt(w[vertex], vecf16_t(kNearWClip));
+        outsideNear &= nearClipped;
+        outsideLeft &= __builtin_nyuzi_mask_cmpf_lt(x[vertex], -w[vertex]);
+        outsideRight &= __builtin_nyuzi_mask_cmpf_gt(x[vertex], w[vertex]);
+        outsideBottom &= __builtin_nyuzi_mask_cmpf_lt(y[vertex], -w[vertex]);
+        outsideTop &= __builtin_nyuzi_mask_cmpf_gt(y[vertex], w[vertex]);
+
+        const vecf16_t guardX = w[vertex] * fGuardBandX;
+        const vecf16_t guardY = w[vertex] * fGuardBandY;
+        needsClip |= nearClipped
+                     | __builtin_nyuzi_mask_cmpf_lt(x[vertex], -guardX)
+                     | __builtin_nyuzi_mask_cmpf_gt(x[vertex], guardX)
+                     | __builtin_nyuzi_mask_cmpf_lt(y[vertex], -guardY)
+                     | __builtin_nyuzi_mask_cmpf_gt(y[vertex], guardY);
+    }
 
-    case 3:
-        clipTwo(fBaseSequenceNumber + triangleIndex, state, params0, params1, params2);
-        break;
+    // Trivially reject triangles that are completely outside the view volume.
+    const int visibleMask = batchMask & ~(outsideNear | outsideLeft | outsideRight
+                                          | outsideBottom | outsideTop);
+
+    // Triangles that straddle the near plane or extend past the guard band
+    // go through the scalar clipping path.
+    unsigned int clipMask = static_cast<unsigned int>(visibleMask & needsClip);
+    const int numSubmitted = __builtin_popcount(batchMask);
+    const int numClipped = __builtin_popcount(clipMask);
+    int numBinned = 0;
+    while (clipMask)
+    {
+        const int lane = __builtin_ctz(clipMask);
+        clipMask &= ~(1 << lane);
+        numBinned += clipTriangle(sequenceBase + lane, state,
+                                  reinterpret_cast<const float*>(paramPtrs[0][lane]),
+                                  reinterpret_cast<const float*>(paramPtrs[1][lane]),
+                                  reinterpret_cast<const float*>(paramPtrs[2][lane]));
+    }
 
-    case 6:
-        clipTwo(fBaseSequenceNumber + triangleIndex, state, params1, params2, params0);
-        break;
+    unsigned int activeMask = static_cast<unsigned int>(visibleMask & ~needsClip);
+    if (activeMask == 0)
+    {
+        __sync_fetch_and_add(&fStats.trianglesSubmitted, numSubmitted);
+        __sync_fetch_and_add(&fStats.trianglesCulled, numSubmitted - numClipped);
+        __sync_fetch_and_add(&fStats.trianglesClipped, numClipped);
+        __sync_fetch_and_add(&fStats.trianglesBinned, numBinned);
+        return;
+    }
 
-    case 5:
-        clipTwo(fBaseSequenceNumber + triangleIndex, state, params2, params0, params1);
-        break;
+    // Perform perspective division and convert screen space coordinates to
+    // raster coordinates.
+    // XXX Z should be divided against W here.  This is a bit of a hack.
+    const float halfWidth = fFbWidth / 2;
+    const float halfHeight = fFbHeight / 2;
+    veci16_t xRast[3];
+    veci16_t yRast[3];
+    for (int vertex = 0; vertex < 3; vertex++)
+    {
+        vecf16_t oneOverW = 1.0f / w[vertex];
+        x[vertex] *= oneOverW;
+        y[vertex] *= oneOverW;
+        xRast[vertex] = __builtin_convertvector(x[vertex] * halfWidth + halfWidth, veci16_t);
+        yRast[vertex] = __builtin_convertvector(-y[vertex] * halfHeight + halfHeight, veci16_t);
+    }
 
-        // Else is totally clipped, ignore
+    // Remove edge-on triangles, which won't be rasterized correctly, then
+    // perform backface culling.
+    veci16_t winding = (xRast[1] - xRast[0]) * (yRast[2] - yRast[0]) - (yRast[1] - yRast[0])
+                       * (xRast[2] - xRast[0]);
+    activeMask &= __builtin_nyuzi_mask_cmpi_ne(winding, veci16_t(0));
+    const vmask_t woundCCW = __builtin_nyuzi_mask_cmpi_slt(winding, veci16_t(0));
+    if (state.cullingMode == RenderState::kCullCW)
+        activeMask &= woundCCW;
+    else if (state.cullingMode == RenderState::kCullCCW)
+        activeMask &= ~woundCCW;
+
+    // Compute bounding boxes and cull triangles that are outside the sides of
+    // the view frustum
+    veci16_t bbLeft = min(min(xRast[0], xRast[1]), xRast[2]);
+    veci16_t bbTop = min(min(yRast[0], yRast[1]), yRast[2]);
+    veci16_t bbRight = max(max(xRast[0], xRast[1]), xRast[2]);
+    veci16_t bbBottom = max(max(yRast[0], yRast[1]), yRast[2]);
+    const vmask_t inViewX = __builtin_nyuzi_mask_cmpi_sge(bbRight, veci16_t(0))
+                            & __builtin_nyuzi_mask_cmpi_slt(bbLeft, veci16_t(fFbWidth));
+    const vmask_t inViewY = __builtin_nyuzi_mask_cmpi_sge(bbBottom, veci16_t(0))
+                            & __builtin_nyuzi_mask_cmpi_slt(bbTop, veci16_t(fFbHeight));
+    activeMask &= inViewX;
+    activeMask &= inViewY;
+
+    const int numUnclipped = __builtin_popcount(activeMask);
+    __sync_fetch_and_add(&fStats.trianglesSubmitted, numSubmitted);
+    __sync_fetch_and_add(&fStats.trianglesCulled, numSubmitted - numClipped - numUnclipped);
+    __sync_fetch_and_add(&fStats.trianglesClipped, numClipped);
+    __sync_fetch_and_add(&fStats.trianglesBinned, numBinned + numUnclipped);
+
+    // Bin the remaining triangles
+    while (activeMask)
+    {
+        const int lane = __builtin_ctz(activeMask);
+        activeMask &= ~(1 << lane);
+
+        Triangle tri;
+        tri.sequenceNumber = sequenceBase + lane;
+        tri.state = &state;
+        tri.x0 = x[0][lane];
+        tri.y0 = y[0][lane];
+        tri.z0 = z[0][lane];
+        tri.x1 = x[1][lane];
+        tri.y1 = y[1][lane];
+        tri.z1 = z[1][lane];
+        tri.x2 = x[2][lane];
+        tri.y2 = y[2][lane];
+        tri.z2 = z[2][lane];
+        tri.x0Rast = xRast[0][lane];
+        tri.y0Rast = yRast[0][lane];
+        tri.x1Rast = xRast[1][lane];
+        tri.y1Rast = yRast[1][lane];
+        tri.x2Rast = xRast[2][lane];
+        tri.y2Rast = yRast[2][lane];
+        tri.woundCCW = (woundCCW & (1 << lane)) != 0;
+        binTriangle(tri, state, reinterpret_cast<const float*>(paramPtrs[0][lane]),
+                    reinterpret_cast<const float*>(paramPtrs[1][lane]),
+                    reinterpret_cast<const float*>(paramPtrs[2][lane]),
+                    bbLeft[lane], bbTop[lane], bbRight[lane], bbBottom[lane]);
     }
 }
 
 //
-// Performs the second half of triangle setup after clipping: perspective
-// division, backface culling, and binning.
+// Performs the second half of triangle setup for triangles that were
+// clipped: perspective division, backface culling, and binning. This is the
+// scalar equivalent of the vector code in setUpTriangles. Returns false if
+// the triangle was culled.
 //
 
-void RenderContext::enqueueTriangle(int sequence, const RenderState &state, const float *params0,
+bool RenderContext::enqueueTriangle(int sequence, const RenderState &state, const float *params0,
                                     const float *params1, const float *params2)
 {
     Triangle tri;
@@ -350,14 +766,14 @@ void RenderContext::enqueueTriangle(int sequence, const RenderState &state, cons
     int winding = (tri.x1Rast - tri.x0Rast) * (tri.y2Rast - tri.y0Rast) - (tri.y1Rast - tri.y0Rast)
                   * (tri.x2Rast - tri.x0Rast);
     if (winding == 0)
-        return;	// remove edge-on triangles, which won't be rasterized correctly.
+        return false;	// remove edge-on triangles, which won't be rasterized correctly.
 
     tri.woundCCW = winding < 0;
 
     // Backface culling
     if ((state.cullingMode == RenderState::kCullCW && !tri.woundCCW)
             || (state.cullingMode == RenderState::kCullCCW && tri.woundCCW))
-        return;
+        return false;
 
     // Compute bounding box
     int bbLeft = tri.x0Rast < tri.x1Rast ? tri.x0Rast : tri.x1Rast;
@@ -371,8 +787,21 @@ void RenderContext::enqueueTriangle(int sequence, const RenderState &state, cons
 
     // Cull triangles that are outside the sides of the view frustum
     if (bbRight < 0 || bbLeft >= fFbWidth || bbBottom < 0 || bbTop >= fFbHeight)
-        return;
+        return false;
+
+    binTriangle(tri, state, params0, params1, params2, bbLeft, bbTop, bbRight, bbBottom);
+    return true;
+}
+
+//
+// Copy the parameters of a triangle that has passed setup and insert it into
+// the queues of all tiles its bounding box overlaps.
+//
 
+void RenderContext::binTriangle(Triangle &tri, const RenderState &state, const float *params0,
+                                const float *params1, const float *params2, int bbLeft,
+                                int bbTop, int bbRight, int bbBottom)
+{
     // Copy parameters into triangle structure, skipping position which is already
     // in x0/y0/z0/x1...
     unsigned int paramSize = sizeof(float) * static_cast<unsigned int>(state.fParamsPerVertex - 4);
@@ -384,10 +813,10 @@ void RenderContext::enqueueTriangle(int sequence, const RenderState &state, cons
 
     // Determine which tiles this triangle may overlap with a simple
     // bounding box check.  Enqueue it in the queues for each tile.
-    int minTileX = max(bbLeft / kTileSize, 0);
-    int maxTileX = min(bbRight / kTileSize, fTileColumns - 1);
-    int minTileY = max(bbTop / kTileSize, 0);
-    int maxTileY = min(bbBottom / kTileSize, fTileRows - 1);
+    int minTileX = max(bbLeft >> fTileSizeBits, 0);
+    int maxTileX = min(bbRight >> fTileSizeBits, fTileColumns - 1);
+    int minTileY = max(bbTop >> fTileSizeBits, 0);
+    int maxTileY = min(bbBottom >> fTileSizeBits, fTileRows - 1);
     for (int tiley = minTileY; tiley <= maxTileY; tiley++)
     {
         for (int tilex = minTileX; tilex <= maxTileX; tilex++)
@@ -423,74 +852,224 @@ void RenderContext::fillTile(int index)
 {
     const int x = index % fTileColumns;
     const int y = index / fTileColumns;
-    const int tileX = x * kTileSize;
-    const int tileY = y * kTileSize;
+    const int tileX = x * fTileSize;
+    const int tileY = y * fTileSize;
     TriangleArray &tile = fTiles[y * fTileColumns + x];
     Surface *colorBuffer = fRenderTarget->getColorBuffer();
+    const unsigned int startCycles = get_cycle_count();
+    int numTriangles = 0;
 
     if (fClearColorBuffer)
-        colorBuffer->clearTile(tileX, tileY, fClearColor);
+    {
+        const unsigned int clearValue = colorBuffer->packColor(fClearColor[0],
+                                        fClearColor[1], fClearColor[2]);
+        if (tile.empty() && !fPostProcessor)
+        {
+            // If this tile was also empty in the last frame, memory already
+            // holds the clear color and nothing needs to be written.
+            if (!fColorClearState.isCleared(index, clearValue))
+            {
+                colorBuffer->clearTile(tileX, tileY, clearValue);
+                colorBuffer->flushTile(tileX, tileY);
+                fColorClearState.setCleared(index, clearValue);
+                __sync_fetch_and_add(&fStats.tilesFlushed, 1);
+            }
+            else
+                __sync_fetch_and_add(&fStats.tilesClearSkipped, 1);
 
-    // Initialize Z-Buffer to -infinity
-    if (fRenderTarget->getDepthBuffer())
-        fRenderTarget->getDepthBuffer()->clearTile(tileX, tileY, 0xff800000);
+            fTileTriangles[index] = 0;
+            fTileFillCycles[index] = get_cycle_count() - startCycles;
+            return;
+        }
+
+        colorBuffer->clearTile(tileX, tileY, clearValue);
+    }
+    else if (tile.empty() && !fPostProcessor)
+    {
+        // Nothing changed in this tile, so it doesn't need to be flushed.
+        fTileTriangles[index] = 0;
+        fTileFillCycles[index] = get_cycle_count() - startCycles;
+        return;
+    }
+
+    fColorClearState.setDirty(index);
+
+    // The depth buffer is cleared when the first triangle that uses it is
+    // drawn, so tiles that don't have any are never written.
+    Surface *depthBuffer = fRenderTarget->getDepthBuffer();
+    bool depthInitialized = false;
 
     // The triangles may have been reordered during the parallel vertex shading
     // phase.  Put them back in the order they were submitted.
     tile.sort();
 
-    // Walk through all triangles that overlap this tile and render
     TriangleFiller filler(fRenderTarget);
+    if (fDepthPrepass && depthBuffer)
+    {
+        // Depth pre-pass: rasterize the depth of all opaque triangles first,
+        // then shade only pixels that are visible in the final image. The
+        // tile is already in the cache, so the extra pass is cheaper than
+        // shading pixels that are later overwritten.
+        filler.setPass(TriangleFiller::kDepthOnlyPass);
+        for (const Triangle &tri : tile)
+        {
+            const RenderState &state = *tri.state;
+            if (!state.fEnableDepthBuffer || state.fEnableBlend
+                    || !triangleOverlapsTile(tri, tileX, tileY))
+                continue;
+
+            if (!depthInitialized)
+            {
+                clearDepthTile(index, tileX, tileY);
+                depthInitialized = true;
+            }
+
+            filler.setUpTriangle(&state, tri.x0, tri.y0, tri.z0, tri.x1, tri.y1, tri.z1, tri.x2,
+                                 tri.y2, tri.z2);
+            rasterizeTriangle(filler, tri, tileX, tileY);
+        }
+
+        const int blocksPerRow = fTileSize / 4;
+        const size_t shadedMasksSize = static_cast<size_t>(blocksPerRow * blocksPerRow)
+                                       * sizeof(vmask_t);
+        vmask_t *shadedMasks = static_cast<vmask_t*>(fAllocator.alloc(shadedMasksSize));
+        memset(shadedMasks, 0, shadedMasksSize);
+        filler.setShadedMasks(shadedMasks, fTileSize);
+        filler.setPass(TriangleFiller::kShadeVisiblePass);
+    }
+
+    // Walk through all triangles that overlap this tile and render
     for (const Triangle &tri : tile)
     {
         const RenderState &state = *tri.state;
+        numTriangles++;
 
         // Do a better check to see if this triangle overlaps the tile.
         // If not, skip setting up interpolators.
-        if (tri.woundCCW)
+        if (!triangleOverlapsTile(tri, tileX, tileY))
+            continue;
+
+        if (state.fEnableDepthBuffer && depthBuffer && !depthInitialized)
         {
-            if (triangleRejected(tileX, tileY, tileX + kTileSize,
-                                 tileY + kTileSize, tri.x0Rast, tri.y0Rast, tri.x1Rast,
-                                 tri.y1Rast, tri.x2Rast, tri.y2Rast))
-            {
-                continue;
-            }
-        }
-        else
-        {
-            if (triangleRejected(tileX, tileY, tileX + kTileSize,
-                                 tileY + kTileSize, tri.x0Rast, tri.y0Rast, tri.x2Rast,
-                                 tri.y2Rast, tri.x1Rast, tri.y1Rast))
-            {
-                continue;
-            }
+            clearDepthTile(index, tileX, tileY);
+            depthInitialized = true;
         }
 
         // Set up parameters and rasterize triangle.
         filler.setUpTriangle(&state, tri.x0, tri.y0, tri.z0, tri.x1, tri.y1, tri.z1, tri.x2,
                              tri.y2, tri.z2);
-        for (int paramI = 0; paramI < state.fParamsPerVertex; paramI++)
+        for (int paramI = 0; paramI < state.fParamsPerVertex - 4; paramI++)
         {
             filler.setUpParam(tri.params[paramI],
                               tri.params[(state.fParamsPerVertex - 4) + paramI],
                               tri.params[(state.fParamsPerVertex - 4) * 2 + paramI]);
         }
 
-        if (tri.woundCCW)
+        rasterizeTriangle(filler, tri, tileX, tileY);
+    }
+
+    if (fPostProcessor)
+    {
+        if (depthBuffer && !depthInitialized)
+            clearDepthTile(index, tileX, tileY);
+
+        fPostProcessor->processTile(colorBuffer, depthBuffer, tileX, tileY,
+                                    min(tileX + fTileSize, fFbWidth),
+                                    min(tileY + fTileSize, fFbHeight));
+    }
+
+    colorBuffer->flushTile(tileX, tileY);
+    __sync_fetch_and_add(&fStats.tilesFlushed, 1);
+
+    fTileTriangles[index] = numTriangles;
+    fTileFillCycles[index] = get_cycle_count() - startCycles;
+    __sync_fetch_and_add(&fStats.pixelsShaded, filler.getPixelsShaded());
+    __sync_fetch_and_add(&fStats.pixelsDepthRejected, filler.getPixelsDepthRejected());
+}
+
+//
+// Fill a tile of a render target that only has a depth buffer. Only the
+// depth of each triangle is rasterized: shaders aren't called and parameters
+// aren't interpolated. The depth test doesn't depend on the order the
+// triangles are drawn, so they aren't sorted.
+//
+
+void RenderContext::fillDepthTile(int index)
+{
+    const int x = index % fTileColumns;
+    const int y = index / fTileColumns;
+    const int tileX = x * fTileSize;
+    const int tileY = y * fTileSize;
+    const TriangleArray &tile = fTiles[y * fTileColumns + x];
+    Surface *depthBuffer = fRenderTarget->getDepthBuffer();
+    const unsigned int startCycles = get_cycle_count();
+    const unsigned int clearValue = depthClearValue(depthBuffer);
+    int numTriangles = 0;
+
+    if (tile.empty())
+    {
+        if (!fDepthClearState.isCleared(index, clearValue))
         {
-            fillTriangle(filler, tileX, tileY,
-                         tri.x0Rast, tri.y0Rast, tri.x1Rast, tri.y1Rast, tri.x2Rast, tri.y2Rast,
-                         fFbWidth, fFbHeight);
+            depthBuffer->clearTile(tileX, tileY, clearValue);
+            fDepthClearState.setCleared(index, clearValue);
         }
         else
-        {
-            fillTriangle(filler, tileX, tileY,
-                         tri.x0Rast, tri.y0Rast, tri.x2Rast, tri.y2Rast, tri.x1Rast, tri.y1Rast,
-                         fFbWidth, fFbHeight);
-        }
+            __sync_fetch_and_add(&fStats.tilesClearSkipped, 1);
+
+        fTileTriangles[index] = 0;
+        fTileFillCycles[index] = get_cycle_count() - startCycles;
+        return;
     }
 
-    colorBuffer->flushTile(tileX, tileY);
+    clearDepthTile(index, tileX, tileY);
+    TriangleFiller filler(fRenderTarget);
+    filler.setPass(TriangleFiller::kDepthOnlyPass);
+    for (const Triangle &tri : tile)
+    {
+        numTriangles++;
+        if (!tri.state->fEnableDepthBuffer || !triangleOverlapsTile(tri, tileX, tileY))
+            continue;
+
+        filler.setUpTriangle(tri.state, tri.x0, tri.y0, tri.z0, tri.x1, tri.y1, tri.z1, tri.x2,
+                             tri.y2, tri.z2);
+        rasterizeTriangle(filler, tri, tileX, tileY);
+    }
+
+    fTileTriangles[index] = numTriangles;
+    fTileFillCycles[index] = get_cycle_count() - startCycles;
+}
+
+bool RenderContext::triangleOverlapsTile(const Triangle &tri, int tileX, int tileY) const
+{
+    if (tri.woundCCW)
+    {
+        return !triangleRejected(tileX, tileY, tileX + fTileSize, tileY + fTileSize,
+                                 tri.x0Rast, tri.y0Rast, tri.x1Rast, tri.y1Rast,
+                                 tri.x2Rast, tri.y2Rast);
+    }
+    else
+    {
+        return !triangleRejected(tileX, tileY, tileX + fTileSize, tileY + fTileSize,
+                                 tri.x0Rast, tri.y0Rast, tri.x2Rast, tri.y2Rast,
+                                 tri.x1Rast, tri.y1Rast);
+    }
+}
+
+void RenderContext::rasterizeTriangle(TriangleFiller &filler, const Triangle &tri, int tileX,
+                                      int tileY) const
+{
+    if (tri.woundCCW)
+    {
+        fillTriangle(filler, tileX, tileY, fTileSize,
+                     tri.x0Rast, tri.y0Rast, tri.x1Rast, tri.y1Rast, tri.x2Rast, tri.y2Rast,
+                     fFbWidth, fFbHeight);
+    }
+    else
+    {
+        fillTriangle(filler, tileX, tileY, fTileSize,
+                     tri.x0Rast, tri.y0Rast, tri.x2Rast, tri.y2Rast, tri.x1Rast, tri.y1Rast,
+                     fFbWidth, fFbHeight);
+    }
 }
 
 //
@@ -501,31 +1080,63 @@ void RenderContext::wireframeTile(int index)
 {
     const int x = index % fTileColumns;
     const int y = index / fTileColumns;
-    const int tileX = x * kTileSize;
-    const int tileY = y * kTileSize;
+    const int tileX = x * fTileSize;
+    const int tileY = y * fTileSize;
     const TriangleArray &tile = fTiles[y * fTileColumns + x];
 
     Surface *colorBuffer = fRenderTarget->getColorBuffer();
-    colorBuffer->clearTile(tileX, tileY, fClearColor);
-    int bottomClip = tileY + kTileSize - 1;
-    int rightClip = tileX + kTileSize - 1;
-    if (bottomClip >= colorBuffer->getHeight())
-        bottomClip = colorBuffer->getHeight() - 1;
+    const unsigned int startCycles = get_cycle_count();
+    int numTriangles = 0;
+    const unsigned int clearValue = colorBuffer->packColor(fClearColor[0], fClearColor[1],
+                                    fClearColor[2]);
+    colorBuffer->clearTile(tileX, tileY, clearValue);
+    if (tile.empty())
+        fColorClearState.setCleared(index, clearValue);
+    else
+        fColorClearState.setDirty(index);
 
-    if (rightClip >= colorBuffer->getWidth())
-        rightClip = colorBuffer->getWidth() - 1;
+    Surface *depthBuffer = fWireframeHideOccluded ? fRenderTarget->getDepthBuffer() : nullptr;
+    if (depthBuffer && !tile.empty())
+    {
+        // Hidden line removal. Rasterize the depth of the triangles so the
+        // lines can be tested against it.
+        clearDepthTile(index, tileX, tileY);
+        TriangleFiller filler(fRenderTarget);
+        filler.setPass(TriangleFiller::kDepthOnlyPass);
+        for (const Triangle &tri : tile)
+        {
+            if (!tri.state->fEnableDepthBuffer || !triangleOverlapsTile(tri, tileX, tileY))
+                continue;
 
+            filler.setUpTriangle(tri.state, tri.x0, tri.y0, tri.z0, tri.x1, tri.y1, tri.z1,
+                                 tri.x2, tri.y2, tri.z2);
+            rasterizeTriangle(filler, tri, tileX, tileY);
+        }
+    }
+
+    const int rightClip = min(tileX + fTileSize, fFbWidth) - 1;
+    const int bottomClip = min(tileY + fTileSize, fFbHeight) - 1;
+    const unsigned int lineColor = colorBuffer->packColor(1.0f, 1.0f, 1.0f);
     for (const Triangle &tri : tile)
     {
-        drawLineClipped(colorBuffer, tri.x0Rast, tri.y0Rast, tri.x1Rast, tri.y1Rast, 0xffffffff,
-                        tileX, tileY, rightClip, bottomClip);
-        drawLineClipped(colorBuffer, tri.x1Rast, tri.y1Rast, tri.x2Rast, tri.y2Rast, 0xffffffff,
-                        tileX, tileY, rightClip, bottomClip);
-        drawLineClipped(colorBuffer, tri.x2Rast, tri.y2Rast, tri.x0Rast, tri.y0Rast, 0xffffffff,
-                        tileX, tileY, rightClip, bottomClip);
+        numTriangles++;
+        const Surface *lineDepthBuffer = tri.state->fEnableDepthBuffer ? depthBuffer : nullptr;
+        drawLineVector(colorBuffer, lineDepthBuffer, tri.x0Rast, tri.y0Rast, tri.z0,
+                       tri.x1Rast, tri.y1Rast, tri.z1, lineColor,
+                       tileX, tileY, rightClip, bottomClip);
+        drawLineVector(colorBuffer, lineDepthBuffer, tri.x1Rast, tri.y1Rast, tri.z1,
+                       tri.x2Rast, tri.y2Rast, tri.z2, lineColor,
+                       tileX, tileY, rightClip, bottomClip);
+        drawLineVector(colorBuffer, lineDepthBuffer, tri.x2Rast, tri.y2Rast, tri.z2,
+                       tri.x0Rast, tri.y0Rast, tri.z0, lineColor,
+                       tileX, tileY, rightClip, bottomClip);
     }
 
     colorBuffer->flushTile(tileX, tileY);
+    __sync_fetch_and_add(&fStats.tilesFlushed, 1);
+
+    fTileTriangles[index] = numTriangles;
+    fTileFillCycles[index] = get_cycle_count() - startCycles;
 }
 
 } // namespace librender
\ No newline at end of file
@@ -18,10 +18,14 @@
 #pragma once
 
 #include "CommandQueue.h"
+#include "Matrix.h"
+#include "PostProcessor.h"
 #include "RegionAllocator.h"
 #include "RenderState.h"
+#include "RenderStats.h"
 #include "RenderTarget.h"
 #include "Shader.h"
+#include "TileClearState.h"
 
 namespace librender
 {
@@ -34,7 +38,12 @@ namespace librender
 class RenderContext
 {
 public:
-    explicit RenderContext(unsigned int workingMemSize = 0x400000);
+    // workingMemSize is the size of each chunk of working memory, which holds
+    // draw commands, shaded vertices, and binned triangles for a frame. More
+    // chunks are added as needed. getWorkingMemoryStats can be used to
+    // choose a size that avoids this.
+    explicit RenderContext(size_t workingMemSize = 0x100000);
+    ~RenderContext();
     RenderContext(const RenderContext&) = delete;
     RenderContext& operator=(const RenderContext&) = delete;
 
@@ -73,6 +82,13 @@ public:
     // is called. You will need to call it again for the next frame.
     void bindUniforms(const void *uniforms, size_t size);
 
+    // Pass the contents of a UniformBuffer to shaders. This doesn't copy
+    // the values, and unlike the version above, stays bound for subsequent
+    // frames. The context holds a reference to the buffer while it is
+    // bound and until draw calls that use it have been rendered, so the
+    // caller may release it at any time.
+    void bindUniforms(UniformBuffer *buffer);
+
     // If enabled is true, this will
     // - Update the depth buffer for each pixel covered by triangles
     // - Perform a depth test and reject any pixels that do not match.
@@ -93,15 +109,71 @@ public:
     // Indices reference into bound vertex attribute buffer.
     void drawElements(const RenderBuffer *indices);
 
+    // Draw instanceCount copies of the primitives. instanceData has one
+    // element for each instance, and the shader's getNumInstanceAttribs
+    // values from that element are passed to shadeVertices after the vertex
+    // attributes. Vertices for all instances are shaded together, and
+    // triangles are rendered in instance order.
+    void drawElementsInstanced(const RenderBuffer *indices, int instanceCount,
+                               const RenderBuffer *instanceData);
+
+    // Same as drawElements, but first checks the axis aligned box from boundsMin to
+    // boundsMax against the view frustum, and drops the draw call if the box
+    // is entirely outside it. This avoids shading vertices and setting up
+    // triangles for meshes that aren't visible. The bounds are in the same
+    // space as the vertex positions, and mvpMatrix transforms them to clip
+    // space (normally the same matrix the vertex shader uses). Returns false
+    // if the draw call was culled.
+    bool drawElements(const RenderBuffer *indices, const Matrix &mvpMatrix,
+                      const Vec3 &boundsMin, const Vec3 &boundsMax);
+
     // Execute all submitted drawing commands. No rendering occurs until
     // this is called.
     void finish();
 
     // If this is set, no pixels will be rendered, but lines will be drawn at the
-    // edge of rendered triangles.
-    void enableWireframeMode(bool enable)
+    // edge of rendered triangles. If hideOccluded is also set, the depth of
+    // the triangles is rendered first, and lines of triangles with depth
+    // testing enabled are not drawn where they are behind other triangles.
+    void enableWireframeMode(bool enable, bool hideOccluded = false)
     {
         fWireframeMode = enable;
+        fWireframeHideOccluded = hideOccluded;
+    }
+
+    // If this is enabled, each tile is rendered in two passes. The first
+    // computes the depth of all opaque, depth tested triangles, and the second
+    // only shades pixels of those triangles that are visible in the final image.
+    // This avoids shading pixels that are later covered, at the cost of
+    // rasterizing opaque triangles twice. Blended triangles are depth tested
+    // normally in the second pass, so they should be drawn after opaque ones.
+    // Where several triangles have the same depth at a pixel, only the first
+    // one drawn is shaded, as with the normal test, so the image is the same
+    // with or without the pre-pass. This matters most for 16-bit depth
+    // buffers, where nearby surfaces often quantize to the same value.
+    void enableDepthPrepass(bool enable)
+    {
+        fDepthPrepass = enable;
+    }
+
+    // Apply processor to each tile after it has been drawn, while it is
+    // still in the cache. This stays bound for subsequent frames. Pass
+    // nullptr to disable it. This doesn't apply in wireframe mode.
+    void bindPostProcessor(const PostProcessor *processor)
+    {
+        fPostProcessor = processor;
+    }
+
+    // Set the width and height of the tiles the render target is divided
+    // into: 32, 64 (the default), or 128 pixels. Smaller tiles use less of
+    // the L2 cache and balance work across threads better, but triangles
+    // that cover several tiles are set up and rasterized once for each.
+    // This applies to subsequent calls to finish().
+    void setTileSize(int size);
+
+    int getTileSize() const
+    {
+        return fTileSize;
     }
 
     void setCulling(RenderState::CullingMode mode)
@@ -109,6 +181,26 @@ public:
         fCurrentState.cullingMode = mode;
     }
 
+    // Statistics for the last frame rendered, updated each time finish() is
+    // called.
+    const RenderStats &getStats() const
+    {
+        return fStats;
+    }
+
+    // If this is enabled, getStats will include the change in each hardware
+    // performance counter during each rendering phase.
+    void enablePerfCounterStats(bool enable)
+    {
+        fPerfCounterStats = enable;
+    }
+
+    // Working memory usage, updated each time finish() is called.
+    const RegionAllocator::Stats &getWorkingMemoryStats() const
+    {
+        return fAllocator.getStats();
+    }
+
 private:
     struct Triangle
     {
@@ -125,19 +217,30 @@ private:
     };
 
     void shadeVertices(int index);
-    void setUpTriangle(int triangleIndex);
+    void setUpTriangles(int batchIndex);
     void fillTile(int index);
+    void fillDepthTile(int index);
     void wireframeTile(int index);
     static void _shadeVertices(void *_castToContext, int index);
-    static void _setUpTriangle(void *_castToContext, int index);
+    static void _setUpTriangles(void *_castToContext, int index);
     static void _fillTile(void *_castToContext, int index);
+    static void _fillDepthTile(void *_castToContext, int index);
     static void _wireframeTile(void *_castToContext, int index);
-    void clipOne(int sequence, const RenderState &command, const float *params0, const float *params1,
-                 const float *params2);
-    void clipTwo(int sequence, const RenderState &command, const float *params0, const float *params1,
-                 const float *params2);
-    void enqueueTriangle(int sequence, const RenderState &command, const float *params0,
+    void trackClearState();
+    void clearDepthTile(int index, int tileX, int tileY);
+    bool triangleOverlapsTile(const Triangle &tri, int tileX, int tileY) const;
+    void rasterizeTriangle(TriangleFiller &filler, const Triangle &tri, int tileX,
+                           int tileY) const;
+    void startPhase();
+    void endPhase(RenderStats::Phase phase);
+    int clipTriangle(int sequence, const RenderState &command, const float *params0,
+                     const float *params1, const float *params2);
+    bool enqueueTriangle(int sequence, const RenderState &command, const float *params0,
                          const float *params1, const float *params2);
+    void queueDrawCommand();
+    void binTriangle(Triangle &tri, const RenderState &command, const float *params0,
+                     const float *params1, const float *params2, int bbLeft, int bbTop,
+                     int bbRight, int bbBottom);
 
     typedef CommandQueue<Triangle, 64> TriangleArray;
     typedef CommandQueue<RenderState, 32> DrawQueue;
@@ -147,15 +250,32 @@ private:
     TriangleArray *fTiles = nullptr;
     int fFbWidth = 0;
     int fFbHeight = 0;
+    int fTileSize = kDefaultTileSize;
+    int fTileSizeBits = __builtin_ctz(kDefaultTileSize);
     int fTileColumns = 0;
     int fTileRows = 0;
+    TileClearState fColorClearState;
+    TileClearState fDepthClearState;
+    float fGuardBandX = 1.0f;
+    float fGuardBandY = 1.0f;
     RegionAllocator fAllocator;
     RenderState fCurrentState;
     DrawQueue fDrawQueue;
     DrawQueue::iterator fRenderCommandIterator = fDrawQueue.end();
     int fBaseSequenceNumber = 0;
-    unsigned int fClearColor = 0xff000000;
+    int fDrawCallsCulled = 0;
+    float fClearColor[3] = { 0.0f, 0.0f, 0.0f };
     bool fWireframeMode = false;
+    bool fWireframeHideOccluded = false;
+    bool fDepthPrepass = false;
+    const PostProcessor *fPostProcessor = nullptr;
+    RenderStats fStats;
+    bool fPerfCounterStats = false;
+    unsigned int fPhaseStartCycles = 0;
+    unsigned int fPhaseStartCounters[NUM_COUNTERS];
+    int *fTileTriangles = nullptr;
+    unsigned int *fTileFillCycles = nullptr;
+    int fStatsTileCapacity = 0;
 };
 
 } // namespace librender
@@ -19,6 +19,7 @@
 
 #include "RenderBuffer.h"
 #include "Texture.h"
+#include "UniformBuffer.h"
 
 namespace librender
 {
@@ -31,7 +32,10 @@ struct RenderState
     bool fEnableBlend = false;
     const RenderBuffer *fVertexAttrBuffer = nullptr;
     const RenderBuffer *fIndexBuffer = nullptr;
+    const RenderBuffer *fInstanceData = nullptr;
+    int fInstanceCount = 1;
     const void *fUniforms = nullptr;
+    UniformBuffer *fUniformBuffer = nullptr;	// Set if fUniforms is from a UniformBuffer
     int fParamsPerVertex = 0;
     float *fVertexParams = nullptr;
     const class Shader *fShader = nullptr;
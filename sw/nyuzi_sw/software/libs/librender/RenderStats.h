@@ -0,0 +1,108 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+
+#include <performance_counters.h>
+
+namespace librender
+{
+
+//
+// Statistics for the most recent frame, filled in by RenderContext::finish.
+// Cycle counts come from get_cycle_count, so they are wall clock time
+// and include time other threads were running on the same core.
+//
+
+struct RenderStats
+{
+    enum Phase
+    {
+        kVertexShading,
+        kTriangleSetup,
+        kPixelFill,
+        kNumPhases
+    };
+
+    void reset()
+    {
+        for (int phase = 0; phase < kNumPhases; phase++)
+        {
+            phaseCycles[phase] = 0;
+            for (int counter = 0; counter < NUM_COUNTERS; counter++)
+                phasePerfCounters[phase][counter] = 0;
+        }
+
+        drawCalls = 0;
+        drawCallsCulled = 0;
+        trianglesSubmitted = 0;
+        trianglesCulled = 0;
+        trianglesClipped = 0;
+        trianglesBinned = 0;
+        pixelsShaded = 0;
+        pixelsDepthRejected = 0;
+        tilesFlushed = 0;
+        tilesClearSkipped = 0;
+    }
+
+    // Total cycles spent in each phase, summed over all draw calls.
+    unsigned int phaseCycles[kNumPhases];
+
+    // Change in each hardware performance counter during each phase. This is
+    // only filled in if RenderContext::enablePerfCounterStats was called.
+    // The application chooses which events to count with
+    // set_perf_counter_event.
+    unsigned int phasePerfCounters[kNumPhases][NUM_COUNTERS];
+
+    // Draw calls that were rendered, and draw calls whose bounding box was
+    // outside the view frustum.
+    int drawCalls;
+    int drawCallsCulled;
+
+    // Triangles in index buffers.
+    int trianglesSubmitted;
+
+    // Triangles that were discarded during setup because they were outside
+    // the view frustum, facing away from the camera, or had no area.
+    int trianglesCulled;
+
+    // Triangles that were sent to the clipper because they crossed the near
+    // plane or the guard band.
+    int trianglesClipped;
+
+    // Triangles inserted into tile queues, including ones produced by
+    // clipping. A triangle that overlaps several tiles is counted once.
+    int trianglesBinned;
+
+    // Pixels passed to the pixel shader and pixels removed by the depth test.
+    int pixelsShaded;
+    int pixelsDepthRejected;
+
+    // Color buffer tiles written back to memory, and empty tiles that were
+    // skipped because they already held the clear color from the last frame
+    // drawn to the same surface.
+    int tilesFlushed;
+    int tilesClearSkipped;
+
+    // Per-tile information, in row major order. These point to memory owned
+    // by the RenderContext, which is valid until the next call to finish.
+    int numTiles = 0;
+    const int *tileTriangles = nullptr;
+    const unsigned int *tileFillCycles = nullptr;
+};
+
+} // namespace librender
@@ -24,7 +24,8 @@ namespace librender
 {
 
 //
-// A set of surfaces to render to.
+// A set of surfaces to render to. A target may have only a depth buffer,
+// in which case triangles aren't shaded and only their depth is written.
 //
 class RenderTarget
 {
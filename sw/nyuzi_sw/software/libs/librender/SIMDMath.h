@@ -45,6 +45,12 @@ inline const T& max(const T &a, const T &b)
         return b;
 }
 
+// Gathers and scatters take addresses in 32 bit vector lanes.
+inline int ptrToInt(const void *ptr)
+{
+    return static_cast<int>(reinterpret_cast<uintptr_t>(ptr));
+}
+
 inline vecf16_t min(vecf16_t a, vecf16_t b)
 {
     // This function follows the convention that, if a scalar is used, it is
@@ -68,6 +74,16 @@ inline vecu16_t max(vecu16_t a, vecu16_t b)
     return __builtin_nyuzi_vector_mixf(__builtin_nyuzi_mask_cmpi_ult(a, b), b, a);
 }
 
+inline veci16_t min(veci16_t a, veci16_t b)
+{
+    return __builtin_nyuzi_vector_mixi(__builtin_nyuzi_mask_cmpi_sgt(a, b), b, a);
+}
+
+inline veci16_t max(veci16_t a, veci16_t b)
+{
+    return __builtin_nyuzi_vector_mixi(__builtin_nyuzi_mask_cmpi_slt(a, b), b, a);
+}
+
 inline vecu16_t saturate(vecu16_t in, int max)
 {
     return min(in, vecu16_t(max));
@@ -96,6 +112,17 @@ inline vecf16_t absfv(vecf16_t in)
     return vecf16_t(veci16_t(in) & 0x7fffffff);
 }
 
+// Approximate base 2 logarithm. This is exact for powers of two and linear
+// between them. in must be positive.
+inline vecf16_t log2fv(vecf16_t in)
+{
+    // The casts do not perform conversions, as in isqrtfv below.
+    const veci16_t bits = veci16_t(in);
+    const vecf16_t exponent = __builtin_convertvector(((bits >> 23) & 0xff) - 127, vecf16_t);
+    const vecf16_t mantissa = vecf16_t((bits & 0x7fffff) | 0x3f800000);
+    return exponent + mantissa - 1.0f;
+}
+
 // "Quake" fast inverse square root
 // The integer casts here do not perform float/int conversions
 // but just interpret the numbers directly as the opposite type.
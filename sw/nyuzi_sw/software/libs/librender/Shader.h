@@ -25,6 +25,29 @@
 namespace librender
 {
 
+class TriangleFiller;
+
+// A function that shades and writes one 4x4 block of pixels. It is selected
+// once per triangle based on the render state.
+typedef void (TriangleFiller::*PixelPipeline)(int left, int top, vmask_t mask);
+
+// How a pixel pipeline uses the depth buffer.
+enum DepthMode
+{
+    kDepthDisabled,
+
+    // Reject pixels that are behind the value in the depth buffer, then
+    // write the new depth values.
+    kDepthTestAndWrite,
+
+    // Only keep pixels whose depth matches the value in the depth buffer,
+    // and don't write it. This is used after a depth pre-pass, when the
+    // buffer already holds the depth of the nearest opaque surface.
+    kDepthTestEqual,
+
+    kNumDepthModes
+};
+
 enum ColorChannel
 {
     kColorR,
@@ -54,6 +77,8 @@ public:
 
     // This is called on batches of up to 16 vertices. Attributes come in, read in
     // from RenderBuffers, and parameters are returned into outParams.
+    // For instanced draws, inAttribs has the vertex attributes followed by
+    // the attributes of the instance each vertex belongs to.
     virtual void shadeVertices(vecf16_t *outParams, const vecf16_t *inAttribs,
                                const void *uniforms, vmask_t mask) const = 0;
 
@@ -65,6 +90,15 @@ public:
                              const void *uniforms, const Texture * const * sampler,
                              vmask_t mask) const = 0;
 
+    // Return a pixel pipeline specialized for this shader and render state,
+    // or nullptr to use the generic pipeline, which calls shadePixels
+    // through the vtable. Shaders usually don't override this directly, but
+    // derive from InlineShader, which implements it.
+    virtual PixelPipeline getPixelPipeline(DepthMode, bool, bool) const
+    {
+        return nullptr;
+    }
+
     // Number of parameters that shadeVertices returns for each vertex.
     int getNumParams() const
     {
@@ -77,15 +111,24 @@ public:
         return fAttribsPerVertex;
     }
 
+    // Number of attributes read from the instance data buffer for
+    // drawElementsInstanced.
+    int getNumInstanceAttribs() const
+    {
+        return fAttribsPerInstance;
+    }
+
 protected:
-    Shader(int attribsPerVertex, int paramsPerVertex)
+    Shader(int attribsPerVertex, int paramsPerVertex, int attribsPerInstance = 0)
         : fParamsPerVertex(paramsPerVertex),
-          fAttribsPerVertex(attribsPerVertex)
+          fAttribsPerVertex(attribsPerVertex),
+          fAttribsPerInstance(attribsPerInstance)
     {}
 
 private:
     int fParamsPerVertex;
     int fAttribsPerVertex;
+    int fAttribsPerInstance;
 };
 
 } // namespace librender
@@ -15,31 +15,101 @@
 //
 
 
+#include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "Surface.h"
 
 namespace librender
 {
 
-Surface::Surface(int width, int height, void *base)
+namespace
+{
+
+int bytesPerPixel(SurfaceFormat format)
+{
+    switch (format)
+    {
+    case kRGB565:
+    case kR16:
+        return 2;
+
+    case kR8:
+        return 1;
+
+    case kBC1:
+    case kBC3:
+        return 0;
+
+    default:
+        return 4;
+    }
+}
+
+int computeStride(int width, SurfaceFormat format)
+{
+    switch (format)
+    {
+    case kBC1:
+        return width / 4 * 8;
+
+    case kBC3:
+        return width / 4 * 16;
+
+    case kRGBA8888Tiled:
+        return width / 4 * kCacheLineSize;
+
+    default:
+        return width * bytesPerPixel(format);
+    }
+}
+
+// Rows of pixels, or rows of blocks for block formats
+int computeRows(int height, SurfaceFormat format)
+{
+    switch (format)
+    {
+    case kBC1:
+    case kBC3:
+    case kRGBA8888Tiled:
+        return height / 4;
+
+    default:
+        return height;
+    }
+}
+
+// Pick the pixels in each 32-bit word, for packing 16 bit and 8 bit pixels
+// in a 4x4 block.
+const veci16_t kEvenLanes = { 0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14 };
+const veci16_t kOddLanes = { 1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15 };
+const veci16_t kColumn0Lanes = { 0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12 };
+
+} // namespace
+
+Surface::Surface(int width, int height, void *base, SurfaceFormat format)
     : fWidth(width),
       fHeight(height),
-      fStride(width * kBytesPerPixel),
-      fBaseAddress(reinterpret_cast<int>(base)),
+      fStride(computeStride(width, format)),
+      fBaseAddress(ptrToInt(base)),
+      fFormat(format),
+      fBytesPerPixel(bytesPerPixel(format)),
       fOwnedPointer(false)
 {
     initializeOffsetVectors();
 }
 
-Surface::Surface(int width, int height)
+Surface::Surface(int width, int height, SurfaceFormat format)
     : fWidth(width),
       fHeight(height),
-      fStride(width * kBytesPerPixel),
+      fStride(computeStride(width, format)),
+      fFormat(format),
+      fBytesPerPixel(bytesPerPixel(format)),
       fOwnedPointer(true)
 {
-    fBaseAddress = reinterpret_cast<int>(memalign(kCacheLineSize,
-                                         static_cast<size_t>(width * height * kBytesPerPixel)));
+    fBaseAddress = ptrToInt(memalign(kCacheLineSize,
+                                     static_cast<size_t>(fStride * computeRows(height, format))));
     initializeOffsetVectors();
 }
 
@@ -74,60 +144,213 @@ void Surface::initializeOffsetVectors()
 
     fYStep *= twoOverHeight;
 
-    f4x4AtOrigin =
+    const veci16_t kColumns =
     {
-        0, 4, 8, 12,
-        0, 4, 8, 12,
-        0, 4, 8, 12,
-        0, 4, 8, 12
+        0, 1, 2, 3,
+        0, 1, 2, 3,
+        0, 1, 2, 3,
+        0, 1, 2, 3
     };
 
-    veci16_t widthOffset =
+    const veci16_t kRows =
     {
         0, 0, 0, 0,
-        4, 4, 4, 4,
-        8, 8, 8, 8,
-        12, 12, 12, 12
+        1, 1, 1, 1,
+        2, 2, 2, 2,
+        3, 3, 3, 3
     };
 
-    f4x4AtOrigin += widthOffset * fWidth + fBaseAddress;
+    // When there is more than one pixel per word, several lanes point to the
+    // same word.
+    const veci16_t columnOffset = kColumns * fBytesPerPixel;
+    f4x4AtOrigin = (columnOffset & ~3) + kRows * fStride + fBaseAddress;
+    fLaneShift = vecu16_t((columnOffset & 3) * 8);
+    fPixelMask = fBytesPerPixel >= 4 ? 0xffffffff : (1u << (fBytesPerPixel * 8)) - 1;
+}
+
+void Surface::setTileSize(int size)
+{
+    assert(size >= kMinTileSize && size <= kMaxTileSize && (size & (size - 1)) == 0);
+    fTileSize = size;
+}
+
+void Surface::writePackedBlockMasked(veci16_t ptrs, vmask_t mask, vecu16_t values)
+{
+    // Several pixels share each word. Merge the new pixel values with the
+    // old contents, then combine the pixels in each word into the lane for
+    // its first pixel and write back only those lanes.
+    const vecu16_t oldWords = __builtin_nyuzi_gather_loadi(ptrs);
+    const vecu16_t oldValues = (oldWords >> fLaneShift) & fPixelMask;
+    const vecu16_t newValues = vecu16_t(__builtin_nyuzi_vector_mixi(mask,
+                                        veci16_t(values & fPixelMask),
+                                        veci16_t(oldValues))) << fLaneShift;
+    veci16_t words;
+    int storeMask;
+    if (fBytesPerPixel == 2)
+    {
+        words = __builtin_nyuzi_shufflei(veci16_t(newValues), kEvenLanes)
+                | __builtin_nyuzi_shufflei(veci16_t(newValues), kOddLanes);
+        storeMask = 0x5555 & (mask | (mask >> 1));
+    }
+    else
+    {
+        words = __builtin_nyuzi_shufflei(veci16_t(newValues), kColumn0Lanes)
+                | __builtin_nyuzi_shufflei(veci16_t(newValues), kColumn0Lanes + 1)
+                | __builtin_nyuzi_shufflei(veci16_t(newValues), kColumn0Lanes + 2)
+                | __builtin_nyuzi_shufflei(veci16_t(newValues), kColumn0Lanes + 3);
+        storeMask = 0x1111 & (mask | (mask >> 1) | (mask >> 2) | (mask >> 3));
+    }
+
+    __builtin_nyuzi_scatter_storei_masked(ptrs, words, storeMask);
+}
+
+void Surface::writePackedPixelsMasked(veci16_t ptrs, vmask_t mask, vecu16_t values)
+{
+    // Unlike a 4x4 block, the pixels can be anywhere, and several may share
+    // a word, so store them one at a time.
+    unsigned int remaining = mask;
+    while (remaining)
+    {
+        const int lane = __builtin_ctz(remaining);
+        remaining &= ~(1u << lane);
+        writePixel(ptrs[lane], values[lane]);
+    }
+}
+
+unsigned int Surface::packColor(float r, float g, float b) const
+{
+    switch (fFormat)
+    {
+    case kRGB565:
+        return (static_cast<unsigned int>(r * 31.0f) << 11)
+               | (static_cast<unsigned int>(g * 63.0f) << 5)
+               | static_cast<unsigned int>(b * 31.0f);
+
+    case kR8:
+        return static_cast<unsigned int>(r * 255.0f);
+
+    case kR16:
+        return static_cast<unsigned int>(r * 65535.0f);
+
+    case kR32F:
+    {
+        union
+        {
+            float f;
+            unsigned int i;
+        } value;
+
+        value.f = r;
+        return value.i;
+    }
+
+    default:
+        return 0xff000000 | (static_cast<unsigned int>(b * 255.0f) << 16)
+               | (static_cast<unsigned int>(g * 255.0f) << 8)
+               | static_cast<unsigned int>(r * 255.0f);
+    }
 }
 
 void Surface::clearTileSlow(int left, int top, unsigned int value)
 {
-    veci16_t *ptr = reinterpret_cast<veci16_t*>(fBaseAddress + (left + top * fWidth)
-                    * kBytesPerPixel);
-    const veci16_t kClearColor = veci16_t(value);
-    int right = min(kTileSize, fWidth - left);
-    int bottom = min(kTileSize, fHeight - top);
-    const int kStride = ((fWidth - right) * kBytesPerPixel / kVectorSize);
+    const unsigned int wordValue = replicatePixel(value);
+    const veci16_t kClearColor = veci16_t(wordValue);
+    int right = min(fTileSize, fWidth - left);
+    int bottom = min(fTileSize, fHeight - top);
+    const int kRowBytes = right * fBytesPerPixel;
 
+    // The stride isn't always a multiple of the vector size, so each row
+    // starts at its own offset from the base address, and may begin and end
+    // in the middle of a vector. Those parts are cleared a pixel at a time
+    // up to a word boundary, then a word at a time.
     for (int y = 0; y < bottom; y++)
     {
+        const int rowStart = fBaseAddress + left * fBytesPerPixel + (top + y) * fStride;
+        const int rowEnd = rowStart + kRowBytes;
+        int ptr = rowStart;
+        while (ptr < rowEnd && (ptr & 3) != 0)
+        {
+            writePixel(ptr, value);
+            ptr += fBytesPerPixel;
+        }
+
+        while (ptr + 4 <= rowEnd && (ptr & (kVectorSize - 1)) != 0)
+        {
+            *reinterpret_cast<unsigned int*>(ptr) = wordValue;
+            ptr += 4;
+        }
+
         // XXX LLVM ends up turning this into memset
-        for (int x = 0; x < right; x += 16)
-            *ptr++ = kClearColor;
+        while (ptr + kVectorSize <= rowEnd)
+        {
+            *reinterpret_cast<veci16_t*>(ptr) = kClearColor;
+            ptr += kVectorSize;
+        }
 
-        ptr += kStride;
+        while (ptr + 4 <= rowEnd)
+        {
+            *reinterpret_cast<unsigned int*>(ptr) = wordValue;
+            ptr += 4;
+        }
+
+        while (ptr < rowEnd)
+        {
+            writePixel(ptr, value);
+            ptr += fBytesPerPixel;
+        }
+    }
+}
+
+void Surface::loadPixels(const void *pixels)
+{
+    assert(fBytesPerPixel != 0);
+    if (fFormat != kRGBA8888Tiled)
+    {
+        memcpy(bits(), pixels, static_cast<size_t>(fStride * fHeight));
+        return;
+    }
+
+    // Gather each 4x4 block from the source rows and store it as one vector.
+    // f4x4AtOrigin can't be used for the offsets, because fStride is the
+    // distance between rows of blocks, not rows of source pixels.
+    const veci16_t kColumnOffsets = {
+        0, 4, 8, 12, 0, 4, 8, 12, 0, 4, 8, 12, 0, 4, 8, 12
+    };
+    const veci16_t kRows = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 };
+    veci16_t *dest = reinterpret_cast<veci16_t*>(fBaseAddress);
+    const int srcRowStride = fWidth * kBytesPerPixel;
+    const veci16_t srcOffsets = kColumnOffsets + kRows * srcRowStride;
+    const int srcRowBlockStride = srcRowStride * 4;
+    for (int blockY = 0; blockY < fHeight / 4; blockY++)
+    {
+        veci16_t srcPtrs = srcOffsets + ptrToInt(pixels)
+                           + blockY * srcRowBlockStride;
+        for (int blockX = 0; blockX < fWidth / 4; blockX++)
+        {
+            *dest++ = __builtin_nyuzi_gather_loadi(srcPtrs);
+            srcPtrs += 4 * kBytesPerPixel;
+        }
     }
 }
 
 // Push a NxN tile from the L2 cache back to system memory
 void Surface::flushTile(int left, int top)
 {
-    int ptr = fBaseAddress + (left + top * fWidth) * kBytesPerPixel;
-    int right = min(kTileSize, fWidth - left);
-    int bottom = min(kTileSize, fHeight - top);
-    const int kStride = (fWidth - right) * kBytesPerPixel;
+    int right = min(fTileSize, fWidth - left);
+    int bottom = min(fTileSize, fHeight - top);
+    const int kRowBytes = right * fBytesPerPixel;
     for (int y = 0; y < bottom; y++)
     {
-        for (int x = 0; x < right; x += 16)
+        // Neither the row start nor the stride is necessarily a multiple of
+        // the cache line size, so flush every line the row touches.
+        const int rowStart = fBaseAddress + left * fBytesPerPixel + (top + y) * fStride;
+        const int rowEnd = rowStart + kRowBytes;
+        for (int ptr = rowStart & ~(kCacheLineSize - 1); ptr < rowEnd; ptr += kCacheLineSize)
         {
+#ifdef __NYUZI__
             asm("dflush %0" : : "s" (ptr));
-            ptr += kCacheLineSize;
+#endif
         }
-
-        ptr += kStride;
     }
 }
 
@@ -27,27 +27,73 @@ namespace librender
 
 const int kCacheLineSize = 64;
 const int kBytesPerPixel = 4;
-const int kTileSize = 64;
 const int kVectorSize = 64;
 
-static_assert(__builtin_clz(kTileSize) & 1, "Tile size must be power of four");
+// Tiles are square, with a power of two size in this range. The renderer's
+// tile size is set with RenderContext::setTileSize.
+const int kMinTileSize = 32;
+const int kMaxTileSize = 128;
+const int kDefaultTileSize = 64;
+
+// The values are stored in resource files, so they must not change.
+enum SurfaceFormat
+{
+    // 32 bits per pixel, red in the low byte, alpha in the high byte.
+    kRGBA8888 = 0,
+
+    // Block compressed formats. Each 4x4 block of pixels is stored in
+    // contiguous memory, and rows of blocks are stored top to bottom.
+    // These can only be read by Texture; they can't be used as render targets.
+    // BC1 blocks are 64 bits: two RGB565 endpoints followed by 2-bit palette
+    // indices (4 bits per pixel).
+    kBC1 = 1,
+
+    // BC3 blocks are 128 bits: a 64-bit alpha block (two 8-bit endpoints and
+    // 3-bit indices) followed by a BC1 color block (8 bits per pixel).
+    kBC3 = 2,
+
+    // RGBA8888 pixels stored in 4x4 blocks, so each block fills one cache
+    // line. Pixels within a block are in row major order, and blocks are
+    // stored like the block compressed formats above. Texture reads that
+    // cross rows or aren't aligned with the X axis touch fewer cache lines
+    // than with the linear layout. This can only be read by Texture.
+    kRGBA8888Tiled = 3,
+
+    // 16 bits per pixel, 5 bits of red in the high bits, 6 of green, and
+    // 5 of blue.
+    kRGB565 = 4,
+
+    // Single channel formats, which are read by Texture as the red channel.
+    // R8 and R16 are unsigned normalized values, R32F is a float.
+    // R32F and R16 can also be used as depth buffers, where greater values
+    // are closer. Both are computed from the Z parameter output by the vertex
+    // shader, interpolated across the triangle. R32F holds Z. R16 (D16)
+    // holds -1/Z clamped to [0, 1], which only distinguishes depths where Z
+    // is -1 or less. Pixels with Z between -1 and 0 all store 1, and pixels
+    // with Z of 0 or more store 0, the cleared value.
+    kR8 = 5,
+    kR16 = 6,
+    kR32F = 7
+};
 
 //
 // Surface is a chunk of 2D bitmap memory.
 // Because this contains vector elements, this structure must be aligned to vector width.
-// If this is to be used as a destination, the width and height must be a multiple of
-// 64 bytes.
+// If this is to be used as a destination, each row must be a multiple of
+// 64 bytes and the height must be a multiple of 4. Pixel values passed to and
+// returned from the block and pixel functions are in the low bits of each lane.
 //
 
 class Surface
 {
 public:
     // This allocates surface memory and frees it automatically.
-    Surface(int width, int height);
+    Surface(int width, int height, SurfaceFormat format = kRGBA8888);
 
     // This will use the passed pointer as surface memory and will
-    // not attempt to free it.
-    Surface(int width, int height, void *base);
+    // not attempt to free it. For block compressed formats, the width and
+    // height must be multiples of 4.
+    Surface(int width, int height, void *base, SurfaceFormat format = kRGBA8888);
 
     ~Surface();
 
@@ -61,32 +107,52 @@ public:
     //  12 13 14 15
     void writeBlockMasked(int left, int top, vmask_t mask, vecu16_t values)
     {
-        veci16_t ptrs = f4x4AtOrigin + left * 4 + top * fStride;
-        __builtin_nyuzi_scatter_storei_masked(ptrs, values, mask);
+        veci16_t ptrs = f4x4AtOrigin + left * fBytesPerPixel + top * fStride;
+        if (fBytesPerPixel == 4)
+            __builtin_nyuzi_scatter_storei_masked(ptrs, values, mask);
+        else
+            writePackedBlockMasked(ptrs, mask, values);
     }
 
     // Read values from a 4x4 block, in same order as writeBlockMasked
     vecu16_t readBlock(int left, int top) const
     {
-        veci16_t ptrs = f4x4AtOrigin + left * 4 + top * fStride;
-        return __builtin_nyuzi_gather_loadi(ptrs);
+        veci16_t ptrs = f4x4AtOrigin + left * fBytesPerPixel + top * fStride;
+        vecu16_t values = __builtin_nyuzi_gather_loadi(ptrs);
+        if (fBytesPerPixel == 4)
+            return values;
+
+        return (values >> fLaneShift) & fPixelMask;
     }
 
-    // Set all 32-bit values in a tile to a predefined value.
+    // The size of tiles that clearTile and flushTile operate on.
+    void setTileSize(int size);
+
+    int getTileSize() const
+    {
+        return fTileSize;
+    }
+
+    // Set all pixels in a tile to a predefined value, which is in this
+    // surface's format.
     void clearTile(int left, int top, unsigned int value)
     {
-        if (kTileSize == 64 && fWidth - left >= 64 && fHeight - top >= 64)
+        const int rowLines = fTileSize * fBytesPerPixel / kCacheLineSize;
+        if (rowLines * kCacheLineSize == fTileSize * fBytesPerPixel
+                && (fStride & (kCacheLineSize - 1)) == 0
+                && fWidth - left >= fTileSize && fHeight - top >= fTileSize)
         {
-            // Fast clear using block stores
-            vecu16_t vval = value;
-            vecu16_t *ptr = reinterpret_cast<vecu16_t*>(fBaseAddress + (left + top * fWidth) * kBytesPerPixel);
+            // Fast clear using block stores. Each row is a whole number of
+            // cache lines and starts on a cache line boundary.
+            vecu16_t vval = replicatePixel(value);
+            vecu16_t *ptr = reinterpret_cast<vecu16_t*>(fBaseAddress + left * fBytesPerPixel
+                                                        + top * fStride);
             const int kStride = fStride / kCacheLineSize;
-            for (int y = 0; y < 64; y++)
+            for (int y = 0; y < fTileSize; y++)
             {
-                ptr[0] = vval;
-                ptr[1] = vval;
-                ptr[2] = vval;
-                ptr[3] = vval;
+                for (int i = 0; i < rowLines; i++)
+                    ptr[i] = vval;
+
                 ptr += kStride;
             }
         }
@@ -97,11 +163,36 @@ public:
     // Push a tile from the L2 cache back to system memory
     void flushTile(int left, int top);
 
+    // Copy pixels, stored top to bottom in row major order, into this
+    // surface, converting them to its layout. The pixels are in this surface's
+    // format, or RGBA8888 for RGBA8888Tiled. Block compressed formats are not
+    // supported.
+    void loadPixels(const void *pixels);
+
+    // Convert a color, with channels from 0.0-1.0, to this surface's format.
+    unsigned int packColor(float r, float g, float b) const;
+
     veci16_t readPixels(veci16_t tx, veci16_t ty, vmask_t mask) const
     {
-        veci16_t pointers = (ty * fStride + tx * kBytesPerPixel)
+        veci16_t pointers = (ty * fStride + tx * fBytesPerPixel)
+                            + fBaseAddress;
+        if (fBytesPerPixel == 4)
+            return __builtin_nyuzi_gather_loadi_masked(pointers, mask);
+
+        // Load the 32-bit words that contain the pixels
+        const veci16_t words = __builtin_nyuzi_gather_loadi_masked(pointers & ~3, mask);
+        return (words >> ((pointers & 3) * 8)) & static_cast<int>(fPixelMask);
+    }
+
+    // Write values to the pixels at tx, ty in the lanes that are set in mask.
+    void writePixelsMasked(veci16_t tx, veci16_t ty, vmask_t mask, vecu16_t values)
+    {
+        veci16_t pointers = (ty * fStride + tx * fBytesPerPixel)
                             + fBaseAddress;
-        return __builtin_nyuzi_gather_loadi_masked(pointers, mask);
+        if (fBytesPerPixel == 4)
+            __builtin_nyuzi_scatter_storei_masked(pointers, values, mask);
+        else
+            writePackedPixelsMasked(pointers, mask, values);
     }
 
     inline int getWidth() const
@@ -114,11 +205,24 @@ public:
         return fHeight;
     }
 
+    // For block compressed formats, this is the number of bytes between rows
+    // of blocks.
     inline int getStride() const
     {
         return fStride;
     }
 
+    inline SurfaceFormat getFormat() const
+    {
+        return fFormat;
+    }
+
+    // This is zero for block compressed formats.
+    inline int getBytesPerPixel() const
+    {
+        return fBytesPerPixel;
+    }
+
     void *bits() const
     {
         return reinterpret_cast<void*>(fBaseAddress);
@@ -130,6 +234,11 @@ public:
         return memalign(sizeof(vecu16_t), size);
     }
 
+    void operator delete(void *ptr)
+    {
+        free(ptr);
+    }
+
     vecf16_t getXStep() const
     {
         return fXStep;
@@ -143,9 +252,39 @@ public:
 private:
     void initializeOffsetVectors();
     void clearTileSlow(int left, int top, unsigned int value);
+    void writePackedBlockMasked(veci16_t ptrs, vmask_t mask, vecu16_t values);
+    void writePackedPixelsMasked(veci16_t ptrs, vmask_t mask, vecu16_t values);
 
+    // Fill a 32-bit word with copies of a pixel value
+    unsigned int replicatePixel(unsigned int value) const
+    {
+        if (fBytesPerPixel == 1)
+            return (value & 0xff) * 0x01010101;
+        else if (fBytesPerPixel == 2)
+            return (value & 0xffff) * 0x00010001;
+        else
+            return value;
+    }
+
+    void writePixel(int ptr, unsigned int value) const
+    {
+        if (fBytesPerPixel == 1)
+            *reinterpret_cast<uint8_t*>(ptr) = static_cast<uint8_t>(value);
+        else if (fBytesPerPixel == 2)
+            *reinterpret_cast<uint16_t*>(ptr) = static_cast<uint16_t>(value);
+        else
+            *reinterpret_cast<unsigned int*>(ptr) = value;
+    }
+
+    // Address of the 32-bit word that contains each pixel in a 4x4 block
+    // at the top left of the surface.
     veci16_t f4x4AtOrigin;
 
+    // For formats with less than 32 bits per pixel, the position of each
+    // pixel in the block within its word and a mask of the bits in a pixel.
+    vecu16_t fLaneShift;
+    unsigned int fPixelMask;
+
     // For each pixel in a 4x4 grid, these represent the distance in
     // screen coordinates (-1.0 to 1.0) from the upper left pixel.
     vecf16_t fXStep;
@@ -155,8 +294,10 @@ private:
     int fHeight;
     int fStride;
     int fBaseAddress;
+    SurfaceFormat fFormat;
+    int fBytesPerPixel;
     bool fOwnedPointer;
-
+    int fTileSize = kDefaultTileSize;
 };
 
 } // namespace librender
@@ -43,6 +43,189 @@ void unpackRGBA(veci16_t packedColor, vecf16_t *outColor)
                         vecf16_t) * kOneOver255;
 }
 
+void unpackRGB565(veci16_t packedColor, vecf16_t *outColor)
+{
+    outColor[kColorR] = __builtin_convertvector((packedColor >> 11) & 31, vecf16_t)
+                        * (1.0f / 31.0f);
+    outColor[kColorG] = __builtin_convertvector((packedColor >> 5) & 63, vecf16_t)
+                        * (1.0f / 63.0f);
+    outColor[kColorB] = __builtin_convertvector(packedColor & 31, vecf16_t) * (1.0f / 31.0f);
+    outColor[kColorA] = 1.0f;
+}
+
+// Single channel formats are read as the red channel.
+void unpackRed(vecf16_t red, vecf16_t *outColor)
+{
+    outColor[kColorR] = red;
+    outColor[kColorG] = 0.0f;
+    outColor[kColorB] = 0.0f;
+    outColor[kColorA] = 1.0f;
+}
+
+// Weight of the second endpoint for each BC1 palette index. The first four
+// entries are for blocks where color0 > color1, the next four are for blocks
+// with three colors and transparent black.
+const vecf16_t kColorWeights = {
+    0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f,
+    0.0f, 1.0f, 0.5f, 0.0f,
+    0.0f, 0.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 0.0f, 0.0f
+};
+
+// Weight of the second endpoint for each BC3 alpha index. The first eight
+// entries are for blocks where alpha0 > alpha1, which have eight interpolated
+// values. The others are for blocks with six interpolated values, plus 0 and
+// 255, which are handled separately.
+const vecf16_t kAlphaWeights = {
+    0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f,
+    0.0f, 1.0f, 1.0f / 5.0f, 2.0f / 5.0f, 3.0f / 5.0f, 4.0f / 5.0f, 0.0f, 0.0f
+};
+
+// Decode the BC1 color block for each lane. endpoints contains the two
+// RGB565 endpoint colors, and indices contains the 2-bit palette indices
+// for all texels in the block. texelIndex is the position of the texel
+// within the block (0-15). BC3 color blocks always use four colors, so
+// allowTransparent should be false for them.
+void decodeColorBlock(vecu16_t endpoints, vecu16_t indices, vecu16_t texelIndex,
+                      bool allowTransparent, vecf16_t *outColor)
+{
+    const vecu16_t color0 = endpoints & 0xffff;
+    const vecu16_t color1 = endpoints >> 16;
+    const vecu16_t paletteIndex = (indices >> (texelIndex * 2)) & 3;
+    vmask_t threeColor = 0;
+    if (allowTransparent)
+        threeColor = __builtin_nyuzi_mask_cmpi_ule(color0, color1);
+
+    const vecf16_t weight = __builtin_nyuzi_shufflef(kColorWeights, veci16_t(paletteIndex)
+                            | __builtin_nyuzi_vector_mixi(threeColor, veci16_t(4), veci16_t(0)));
+
+    const vecf16_t r0 = __builtin_convertvector((color0 >> 11) & 31, vecf16_t) * (1.0f / 31.0f);
+    const vecf16_t g0 = __builtin_convertvector((color0 >> 5) & 63, vecf16_t) * (1.0f / 63.0f);
+    const vecf16_t b0 = __builtin_convertvector(color0 & 31, vecf16_t) * (1.0f / 31.0f);
+    const vecf16_t r1 = __builtin_convertvector((color1 >> 11) & 31, vecf16_t) * (1.0f / 31.0f);
+    const vecf16_t g1 = __builtin_convertvector((color1 >> 5) & 63, vecf16_t) * (1.0f / 63.0f);
+    const vecf16_t b1 = __builtin_convertvector(color1 & 31, vecf16_t) * (1.0f / 31.0f);
+    outColor[kColorR] = r0 + (r1 - r0) * weight;
+    outColor[kColorG] = g0 + (g1 - g0) * weight;
+    outColor[kColorB] = b0 + (b1 - b0) * weight;
+    outColor[kColorA] = 1.0f;
+
+    // Index 3 in a three color block is transparent black
+    const vmask_t transparent = threeColor & __builtin_nyuzi_mask_cmpi_eq(paletteIndex,
+                                vecu16_t(3));
+    if (transparent)
+    {
+        for (int channel = 0; channel < 4; channel++)
+        {
+            outColor[channel] = __builtin_nyuzi_vector_mixf(transparent, vecf16_t(0.0f),
+                                outColor[channel]);
+        }
+    }
+}
+
+// Fetch texels from a BC1 surface.
+void readBC1Texels(const Surface *surface, veci16_t tx, veci16_t ty, vmask_t mask,
+                   vecf16_t *outColor)
+{
+    const veci16_t blockPtrs = (ty >> 2) * surface->getStride() + (tx >> 2) * 8
+                               + ptrToInt(surface->bits());
+    const vecu16_t endpoints = __builtin_nyuzi_gather_loadi_masked(blockPtrs, mask);
+    const vecu16_t indices = __builtin_nyuzi_gather_loadi_masked(blockPtrs + 4, mask);
+    decodeColorBlock(endpoints, indices, vecu16_t((ty & 3) * 4 + (tx & 3)), true, outColor);
+}
+
+// Fetch texels from a BC3 surface.
+void readBC3Texels(const Surface *surface, veci16_t tx, veci16_t ty, vmask_t mask,
+                   vecf16_t *outColor)
+{
+    const veci16_t blockPtrs = (ty >> 2) * surface->getStride() + (tx >> 2) * 16
+                               + ptrToInt(surface->bits());
+    const vecu16_t texelIndex = vecu16_t((ty & 3) * 4 + (tx & 3));
+    const vecu16_t alphaLow = __builtin_nyuzi_gather_loadi_masked(blockPtrs, mask);
+    const vecu16_t alphaHigh = __builtin_nyuzi_gather_loadi_masked(blockPtrs + 4, mask);
+    const vecu16_t endpoints = __builtin_nyuzi_gather_loadi_masked(blockPtrs + 8, mask);
+    const vecu16_t indices = __builtin_nyuzi_gather_loadi_masked(blockPtrs + 12, mask);
+    decodeColorBlock(endpoints, indices, texelIndex, false, outColor);
+
+    // The 3-bit alpha indices start at bit 16 of the block. Only the index
+    // for texel 5 spans both words.
+    const vecu16_t bitOffset = texelIndex * 3 + 16;
+    const vecu16_t shift = bitOffset & 31;
+    const vecu16_t fromLow = (alphaLow >> shift) | (alphaHigh << ((32 - shift) & 31));
+    const vecu16_t alphaIndex = vecu16_t(__builtin_nyuzi_vector_mixi(
+                                    __builtin_nyuzi_mask_cmpi_uge(bitOffset, vecu16_t(32)),
+                                    veci16_t(alphaHigh >> shift), veci16_t(fromLow))) & 7;
+
+    const vecu16_t alpha0 = alphaLow & 0xff;
+    const vecu16_t alpha1 = (alphaLow >> 8) & 0xff;
+    const vmask_t sixAlpha = __builtin_nyuzi_mask_cmpi_ule(alpha0, alpha1);
+    const vecf16_t weight = __builtin_nyuzi_shufflef(kAlphaWeights, veci16_t(alphaIndex)
+                            | __builtin_nyuzi_vector_mixi(sixAlpha, veci16_t(8), veci16_t(0)));
+    const vecf16_t a0 = __builtin_convertvector(alpha0, vecf16_t);
+    const vecf16_t a1 = __builtin_convertvector(alpha1, vecf16_t);
+    vecf16_t alpha = (a0 + (a1 - a0) * weight) * kOneOver255;
+
+    // Indices 6 and 7 in six alpha blocks are 0 and 255.
+    alpha = __builtin_nyuzi_vector_mixf(sixAlpha & __builtin_nyuzi_mask_cmpi_eq(alphaIndex,
+                                        vecu16_t(6)), vecf16_t(0.0f), alpha);
+    alpha = __builtin_nyuzi_vector_mixf(sixAlpha & __builtin_nyuzi_mask_cmpi_eq(alphaIndex,
+                                        vecu16_t(7)), vecf16_t(1.0f), alpha);
+    outColor[kColorA] = alpha;
+}
+
+// Fetch texels from a surface with 4x4 blocks in each cache line.
+void readTiledTexels(const Surface *surface, veci16_t tx, veci16_t ty, vmask_t mask,
+                     vecf16_t *outColor)
+{
+    const veci16_t pointers = (ty >> 2) * surface->getStride() + (tx >> 2) * kCacheLineSize
+                              + ((ty & 3) * 4 + (tx & 3)) * kBytesPerPixel
+                              + ptrToInt(surface->bits());
+    unpackRGBA(__builtin_nyuzi_gather_loadi_masked(pointers, mask), outColor);
+}
+
+// Read texels at the given coordinates and convert them to floating point
+// channels.
+void readTexels(const Surface *surface, veci16_t tx, veci16_t ty, vmask_t mask,
+                vecf16_t *outColor)
+{
+    switch (surface->getFormat())
+    {
+    case kRGBA8888Tiled:
+        readTiledTexels(surface, tx, ty, mask, outColor);
+        break;
+
+    case kRGB565:
+        unpackRGB565(surface->readPixels(tx, ty, mask), outColor);
+        break;
+
+    case kR8:
+        unpackRed(__builtin_convertvector(surface->readPixels(tx, ty, mask), vecf16_t)
+                  * kOneOver255, outColor);
+        break;
+
+    case kR16:
+        unpackRed(__builtin_convertvector(surface->readPixels(tx, ty, mask), vecf16_t)
+                  * (1.0f / 65535.0f), outColor);
+        break;
+
+    case kR32F:
+        // The cast does not perform a conversion
+        unpackRed(vecf16_t(surface->readPixels(tx, ty, mask)), outColor);
+        break;
+
+    case kBC1:
+        readBC1Texels(surface, tx, ty, mask, outColor);
+        break;
+
+    case kBC3:
+        readBC3Texels(surface, tx, ty, mask, outColor);
+        break;
+
+    default:
+        unpackRGBA(surface->readPixels(tx, ty, mask), outColor);
+    }
+}
+
 // Convert a number in the range -1.0 <= n <= 1.0 to 0.0 <= n < 1.0
 // If the number is less than 0, add 1 so it wraps around
 inline vecf16_t wrapfv(vecf16_t in)
@@ -59,6 +242,13 @@ inline veci16_t wrapiv(veci16_t in, int max)
                                        in, veci16_t(0));
 }
 
+// For each lane in a 4x4 block of pixels, the lanes of the 2x2 group that
+// contains it.
+const veci16_t kLeftLane = { 0, 0, 2, 2, 4, 4, 6, 6, 8, 8, 10, 10, 12, 12, 14, 14 };
+const veci16_t kRightLane = { 1, 1, 3, 3, 5, 5, 7, 7, 9, 9, 11, 11, 13, 13, 15, 15 };
+const veci16_t kTopLane = { 0, 1, 2, 3, 0, 1, 2, 3, 8, 9, 10, 11, 8, 9, 10, 11 };
+const veci16_t kBottomLane = { 4, 5, 6, 7, 4, 5, 6, 7, 12, 13, 14, 15, 12, 13, 14, 15 };
+
 } // namespace
 
 Texture::Texture()
@@ -77,8 +267,6 @@ void Texture::setMipSurface(int mipLevel, const Surface *surface)
 
     if (mipLevel == 0)
     {
-        fBaseMipBits = __builtin_clz(static_cast<unsigned int>(surface->getWidth())) + 1;
-
         // Clear out lower mip levels
         for (int i = 1; i < fMaxMipLevel; i++)
             fMipSurfaces[i] = 0;
@@ -94,19 +282,150 @@ void Texture::setMipSurface(int mipLevel, const Surface *surface)
 void Texture::readPixels(vecf16_t u, vecf16_t v, vmask_t mask,
                          vecf16_t *outColor) const
 {
-    // Determine the closest mip-level. Compute the pitch between the top
-    // two pixels. The reciprocal of this is the scaled texture size. log2 of this
-    // is the mip level.
-    // XXX this is a hack because it only looks at one direction. Should do
-    // something better here.
-    int mipLevel = __builtin_clz(static_cast<unsigned int>(1.0f /
-                                 __builtin_fabsf(u[1] - u[0]))) - fBaseMipBits;
-    if (mipLevel > fMaxMipLevel)
-        mipLevel = fMaxMipLevel;
-    else if (mipLevel < 0)
-        mipLevel = 0;
+    // Compute the rate of change of the texture coordinates between adjacent
+    // pixels. The lanes are a 4x4 block of pixels.
+    const float baseWidth = static_cast<float>(fMipSurfaces[0]->getWidth());
+    const float baseHeight = static_cast<float>(fMipSurfaces[0]->getHeight());
+    vecf16_t dudx;
+    vecf16_t dvdx;
+    vecf16_t dudy;
+    vecf16_t dvdy;
+    if (fPerPixelLod)
+    {
+        // Use the differences within each 2x2 group of pixels
+        dudx = __builtin_nyuzi_shufflef(u, kRightLane) - __builtin_nyuzi_shufflef(u, kLeftLane);
+        dvdx = __builtin_nyuzi_shufflef(v, kRightLane) - __builtin_nyuzi_shufflef(v, kLeftLane);
+        dudy = __builtin_nyuzi_shufflef(u, kBottomLane) - __builtin_nyuzi_shufflef(u, kTopLane);
+        dvdy = __builtin_nyuzi_shufflef(v, kBottomLane) - __builtin_nyuzi_shufflef(v, kTopLane);
+    }
+    else
+    {
+        // Use the differences across the block
+        dudx = (u[3] - u[0]) * (1.0f / 3.0f);
+        dvdx = (v[3] - v[0]) * (1.0f / 3.0f);
+        dudy = (u[12] - u[0]) * (1.0f / 3.0f);
+        dvdy = (v[12] - v[0]) * (1.0f / 3.0f);
+    }
+
+
+    // Squared distance in texels between adjacent pixels in each direction
+    const float widthSq = baseWidth * baseWidth;
+    const float heightSq = baseHeight * baseHeight;
+    const vecf16_t xLengthSq = dudx * dudx * widthSq + dvdx * dvdx * heightSq;
+    const vecf16_t yLengthSq = dudy * dudy * widthSq + dvdy * dvdy * heightSq;
+    const vmask_t xMajor = __builtin_nyuzi_mask_cmpf_ge(xLengthSq, yLengthSq);
+    const vecf16_t majorLengthSq = __builtin_nyuzi_vector_mixf(xMajor, xLengthSq, yLengthSq);
+    const vecf16_t minorLengthSq = __builtin_nyuzi_vector_mixf(xMajor, yLengthSq, xLengthSq);
+
+    // Use enough probes along the major axis that each covers about as many
+    // texels along it as along the minor axis, up to the maximum anisotropy.
+    veci16_t numProbes = 1;
+    for (int i = 1; i < fMaxAnisotropy; i++)
+    {
+        numProbes = __builtin_nyuzi_vector_mixi(__builtin_nyuzi_mask_cmpf_lt(
+                        minorLengthSq * static_cast<float>(i * i), majorLengthSq),
+                                                numProbes + 1, numProbes);
+    }
+
+    // The mip level is log2 of the number of texels each probe covers along
+    // the major axis. Halving the log takes the square root of the length.
+    const vecf16_t probeCount = __builtin_convertvector(numProbes, vecf16_t);
+    const vecf16_t lod = clamp(log2fv(majorLengthSq) * 0.5f - log2fv(probeCount), 0.0f,
+                               static_cast<float>(fMaxMipLevel));
+    if (fMaxAnisotropy == 1)
+    {
+        readLod(u, v, lod, mask, outColor);
+        return;
+    }
+
+    // Average the probes, which are evenly spaced along the major axis and
+    // centered on the sample position.
+    const vecf16_t axisU = __builtin_nyuzi_vector_mixf(xMajor, dudx, dudy);
+    const vecf16_t axisV = __builtin_nyuzi_vector_mixf(xMajor, dvdx, dvdy);
+    const vecf16_t probeWeight = 1.0f / probeCount;
+    vecf16_t probeColor[4];
+    for (int channel = 0; channel < 4; channel++)
+        outColor[channel] = 0.0f;
+
+    for (int probe = 0; probe < fMaxAnisotropy; probe++)
+    {
+        const vmask_t probeMask = mask & __builtin_nyuzi_mask_cmpi_sgt(numProbes, veci16_t(probe));
+        if (!probeMask)
+            break;
+
+        const vecf16_t offset = (static_cast<float>(probe) + 0.5f) * probeWeight - 0.5f;
+        readLod(u + axisU * offset, v + axisV * offset, lod, probeMask, probeColor);
+        for (int channel = 0; channel < 4; channel++)
+        {
+            outColor[channel] = __builtin_nyuzi_vector_mixf(probeMask, outColor[channel]
+                                + probeColor[channel] * probeWeight, outColor[channel]);
+        }
+    }
+}
+
+// Read pixels at a fractional mip level for each lane.
+void Texture::readLod(vecf16_t u, vecf16_t v, vecf16_t lod, vmask_t mask,
+                      vecf16_t *outColor) const
+{
+    if (!fEnableTrilinearFiltering)
+    {
+        readLevels(u, v, __builtin_convertvector(lod + 0.5f, veci16_t), mask, outColor);
+        return;
+    }
+
+    // lod is not negative, so conversion rounds down.
+    const veci16_t levels = __builtin_convertvector(lod, veci16_t);
+    const vecf16_t weight = lod - __builtin_convertvector(levels, vecf16_t);
+    readLevels(u, v, levels, mask, outColor);
+
+    // Lanes at the smallest mip level have a weight of zero.
+    const vmask_t blendMask = mask & __builtin_nyuzi_mask_cmpf_gt(weight, vecf16_t(0.0f));
+    if (blendMask)
+    {
+        vecf16_t nextColor[4];
+        readLevels(u, v, levels + 1, blendMask, nextColor);
+        for (int channel = 0; channel < 4; channel++)
+        {
+            outColor[channel] = __builtin_nyuzi_vector_mixf(blendMask, outColor[channel]
+                                + (nextColor[channel] - outColor[channel]) * weight,
+                                outColor[channel]);
+        }
+    }
+}
+
+// Read pixels from a mip level for each lane. Usually all lanes use the same
+// one, but with per-pixel LOD, this reads each distinct level separately.
+void Texture::readLevels(vecf16_t u, vecf16_t v, veci16_t levels, vmask_t mask,
+                         vecf16_t *outColor) const
+{
+    vmask_t remaining = mask;
+    while (remaining)
+    {
+        const int level = levels[__builtin_ctz(remaining)];
+        const vmask_t levelMask = remaining & __builtin_nyuzi_mask_cmpi_eq(levels,
+                                  veci16_t(level));
+        if (levelMask == mask)
+        {
+            readLevel(u, v, level, mask, outColor);
+            return;
+        }
+
+        vecf16_t levelColor[4];
+        readLevel(u, v, level, levelMask, levelColor);
+        for (int channel = 0; channel < 4; channel++)
+        {
+            outColor[channel] = __builtin_nyuzi_vector_mixf(levelMask, levelColor[channel],
+                                outColor[channel]);
+        }
+
+        remaining &= static_cast<vmask_t>(~levelMask);
+    }
+}
 
-    const Surface *surface = fMipSurfaces[mipLevel];
+void Texture::readLevel(vecf16_t u, vecf16_t v, int level, vmask_t mask,
+                        vecf16_t *outColor) const
+{
+    const Surface *surface = fMipSurfaces[level];
     int mipWidth = surface->getWidth();
     int mipHeight = surface->getHeight();
 
@@ -130,10 +449,10 @@ void Texture::readPixels(vecf16_t u, vecf16_t v, vmask_t mask,
         veci16_t xPlusOne = wrapiv(tx + 1, mipWidth);
         veci16_t yPlusOne = wrapiv(ty + 1, mipHeight);
 
-        unpackRGBA(surface->readPixels(tx, ty, mask), tlColor);
-        unpackRGBA(surface->readPixels(tx, yPlusOne, mask), blColor);
-        unpackRGBA(surface->readPixels(xPlusOne, ty, mask), trColor);
-        unpackRGBA(surface->readPixels(xPlusOne, yPlusOne, mask), brColor);
+        readTexels(surface, tx, ty, mask, tlColor);
+        readTexels(surface, tx, yPlusOne, mask, blColor);
+        readTexels(surface, xPlusOne, ty, mask, trColor);
+        readTexels(surface, xPlusOne, yPlusOne, mask, brColor);
 
         // Compute weights
         vecf16_t wu = fracfv(uRaster);
@@ -155,7 +474,7 @@ void Texture::readPixels(vecf16_t u, vecf16_t v, vmask_t mask,
     else
     {
         // Nearest neighbor
-        unpackRGBA(surface->readPixels(tx, ty, mask), outColor);
+        readTexels(surface, tx, ty, mask, outColor);
     }
 }
 
@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <assert.h>
 #include <stdint.h>
 #include "Surface.h"
 
@@ -55,10 +56,46 @@ public:
         fEnableBilinearFiltering = enable;
     }
 
+    // If enable is true, this will blend between the two closest mip levels.
+    // If false, it will choose the nearest mip level.
+    void enableTrilinearFiltering(bool enable)
+    {
+        fEnableTrilinearFiltering = enable;
+    }
+
+    // readPixels picks a mip level using the rate of change of the texture
+    // coordinates across the 4x4 block of pixels. If this is enabled,
+    // it computes it for each 2x2 group within the block instead, which
+    // is more accurate for blocks where this changes quickly, but slower.
+    void enablePerPixelLod(bool enable)
+    {
+        fPerPixelLod = enable;
+    }
+
+    // When a texture is viewed at an oblique angle, the texels under a pixel
+    // cover a long, narrow area. If this is more than one, readPixels will
+    // take up to this many samples along the long axis, at a more detailed
+    // mip level. If it is one, it picks a mip level using the long axis,
+    // which is blurrier, but reads fewer texels.
+    void setMaxAnisotropy(int maxAnisotropy)
+    {
+        assert(maxAnisotropy >= 1);
+        fMaxAnisotropy = maxAnisotropy;
+    }
+
 private:
+    void readLod(vecf16_t u, vecf16_t v, vecf16_t lod, vmask_t mask,
+                 vecf16_t *outColor) const;
+    void readLevels(vecf16_t u, vecf16_t v, veci16_t levels, vmask_t mask,
+                    vecf16_t *outColor) const;
+    void readLevel(vecf16_t u, vecf16_t v, int level, vmask_t mask,
+                   vecf16_t *outColor) const;
+
     const Surface *fMipSurfaces[kMaxMipLevels];
     bool fEnableBilinearFiltering = false;
-    int fBaseMipBits = 0;
+    bool fEnableTrilinearFiltering = false;
+    bool fPerPixelLod = false;
+    int fMaxAnisotropy = 1;
     int fMaxMipLevel = 0;
 };
 
@@ -0,0 +1,99 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+
+#include "Surface.h"
+
+namespace librender
+{
+
+//
+// Records which tiles of a render target surface hold only a clear value,
+// so RenderContext can skip clearing and flushing tiles that are empty in
+// consecutive frames. This only knows about writes RenderContext makes, so
+// it forgets everything when a different surface or tile size is tracked.
+//
+
+class TileClearState
+{
+public:
+    TileClearState() = default;
+    TileClearState(const TileClearState&) = delete;
+    TileClearState& operator=(const TileClearState&) = delete;
+
+    ~TileClearState()
+    {
+        delete [] fTiles;
+    }
+
+    // Surface may be null, when the target doesn't have this buffer.
+    void track(const Surface *surface, int tileSize, int numTiles)
+    {
+        if (surface == fSurface && tileSize == fTileSize && numTiles == fNumTiles)
+            return;
+
+        if (numTiles > fCapacity)
+        {
+            delete [] fTiles;
+            fTiles = new Tile[numTiles];
+            fCapacity = numTiles;
+        }
+
+        fSurface = surface;
+        fTileSize = tileSize;
+        fNumTiles = numTiles;
+        invalidate();
+    }
+
+    void invalidate()
+    {
+        for (int i = 0; i < fNumTiles; i++)
+            fTiles[i].cleared = false;
+    }
+
+    bool isCleared(int index, unsigned int value) const
+    {
+        return fTiles[index].cleared && fTiles[index].value == value;
+    }
+
+    void setCleared(int index, unsigned int value)
+    {
+        fTiles[index].cleared = true;
+        fTiles[index].value = value;
+    }
+
+    void setDirty(int index)
+    {
+        fTiles[index].cleared = false;
+    }
+
+private:
+    struct Tile
+    {
+        bool cleared;
+        unsigned int value;
+    };
+
+    const Surface *fSurface = nullptr;
+    int fTileSize = 0;
+    int fNumTiles = 0;
+    int fCapacity = 0;
+    Tile *fTiles = nullptr;
+};
+
+} // namespace librender
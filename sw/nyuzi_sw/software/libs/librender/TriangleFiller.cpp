@@ -21,11 +21,55 @@
 namespace librender
 {
 
+namespace
+{
+
+typedef PixelPipeline (*PipelineSelector)(DepthMode depthMode, bool enableBlend,
+        bool perspective);
+
+// Generic pipelines, which call the shader through the vtable, indexed by
+// the number of interpolated parameters.
+const PipelineSelector kGenericPipelines[kMaxInterpolatedParams + 1] = {
+    &TriangleFiller::selectPipeline<Shader, 0>,
+    &TriangleFiller::selectPipeline<Shader, 1>,
+    &TriangleFiller::selectPipeline<Shader, 2>,
+    &TriangleFiller::selectPipeline<Shader, 3>,
+    &TriangleFiller::selectPipeline<Shader, 4>,
+    &TriangleFiller::selectPipeline<Shader, 5>,
+    &TriangleFiller::selectPipeline<Shader, 6>,
+    &TriangleFiller::selectPipeline<Shader, 7>,
+    &TriangleFiller::selectPipeline<Shader, 8>,
+    &TriangleFiller::selectPipeline<Shader, 9>,
+    &TriangleFiller::selectPipeline<Shader, 10>,
+    &TriangleFiller::selectPipeline<Shader, 11>,
+    &TriangleFiller::selectPipeline<Shader, 12>
+};
+
+static_assert(kMaxInterpolatedParams == 12, "kGenericPipelines must be updated");
+
+// Position of each pixel in a 4x4 block relative to its upper left pixel
+const vecf16_t kXOffsets = { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 };
+const vecf16_t kYOffsets = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 };
+
+// The surface whose size determines the raster coordinates. This is the
+// color buffer, or the depth buffer if the target doesn't have one.
+const Surface *getRasterSurface(const RenderTarget *target)
+{
+    return target->getColorBuffer() ? target->getColorBuffer() : target->getDepthBuffer();
+}
+
+} // namespace
+
 TriangleFiller::TriangleFiller(RenderTarget *target)
     :  fTarget(target),
-       fTwoOverWidth(2.0f / target->getColorBuffer()->getWidth()),
-       fTwoOverHeight(2.0f / target->getColorBuffer()->getHeight()),
-       fOneOverZInterpolator()
+       fColorFormat(target->getColorBuffer() ? target->getColorBuffer()->getFormat()
+                    : kRGBA8888),
+       fDepth16(target->getDepthBuffer() && target->getDepthBuffer()->getFormat() == kR16),
+       fTwoOverWidth(2.0f / getRasterSurface(target)->getWidth()),
+       fTwoOverHeight(2.0f / getRasterSurface(target)->getHeight()),
+       fXGradients(0.0f),
+       fYGradients(0.0f),
+       fVertex0Values(0.0f)
 {
 }
 
@@ -47,13 +91,12 @@ void TriangleFiller::setUpTriangle(const RenderState *state,
                                    float x2, float y2, float z2)
 {
     fState = state;
-    fX0 = x0;
-    fY0 = y0;
+    fRasterX0 = (x0 + 1.0f) / fTwoOverWidth;
+    fRasterY0 = (1.0f - y0) / fTwoOverHeight;
     fZ0 = z0;
     fZ1 = z1;
     fZ2 = z2;
 
-
     // The following system of equations describes the relationship
     // between the vertical and horizontal gradients (gx, gy),
     // the parameter values at each point (c0, c1, c2), and the
@@ -81,14 +124,39 @@ void TriangleFiller::setUpTriangle(const RenderState *state,
         fNeedPerspective = true;
 
         // Compute one over Z for interpolation.
-        setUpInterpolator(fOneOverZInterpolator, 1.0f / z0, 1.0f / z1, 1.0f / z2);
+        setUpInterpolator(kOneOverZLane, 1.0f / z0, 1.0f / z1, 1.0f / z2);
     }
 
     fNumParams = 0;
+
+    // Choose a pixel pipeline for this triangle. This avoids checking the
+    // state for every 4x4 block.
+    if (fPass == kDepthOnlyPass)
+    {
+        fPipeline = fNeedPerspective ? &TriangleFiller::depthOnlyPipeline<true>
+                    : &TriangleFiller::depthOnlyPipeline<false>;
+        return;
+    }
+
+    DepthMode depthMode = kDepthDisabled;
+    if (state->fEnableDepthBuffer)
+    {
+        // Blended triangles aren't drawn in the depth pre-pass, so they are
+        // depth tested normally.
+        depthMode = fPass == kShadeVisiblePass && !state->fEnableBlend ? kDepthTestEqual
+                    : kDepthTestAndWrite;
+    }
+
+    fPipeline = state->fShader->getPixelPipeline(depthMode, state->fEnableBlend,
+                fNeedPerspective);
+    if (!fPipeline)
+    {
+        fPipeline = kGenericPipelines[state->fParamsPerVertex - 4](depthMode,
+                    state->fEnableBlend, fNeedPerspective);
+    }
 }
 
-void TriangleFiller::setUpInterpolator(LinearInterpolator &interpolator, float c0, float c1,
-                                       float c2)
+void TriangleFiller::setUpInterpolator(int lane, float c0, float c1, float c2)
 {
     // Multiply by the matrix computed above to find gradients
     float e = c1 - c0;
@@ -96,10 +164,15 @@ void TriangleFiller::setUpInterpolator(LinearInterpolator &interpolator, float c
     float xGradient = fInvGradientMatrix00 * e + fInvGradientMatrix01 * f;
     float yGradient = fInvGradientMatrix10 * e + fInvGradientMatrix11 * f;
 
-    // Compute c at 0, 0
-    float c00 = c0 + -fX0 * xGradient + -fY0 * yGradient;
+    // Convert the gradients from screen space to raster space. Raster Y
+    // increases downward.
+    xGradient *= fTwoOverWidth;
+    yGradient *= -fTwoOverHeight;
 
-    interpolator.init(xGradient, yGradient, c00);
+    fXGradients[lane] = xGradient;
+    fYGradients[lane] = yGradient;
+    fVertex0Values[lane] = c0;
+    fBlockOffsets[lane] = kXOffsets * xGradient + kYOffsets * yGradient;
 }
 
 // c1, c2, and c2 represent the value of the parameter at the three
@@ -108,111 +181,79 @@ void TriangleFiller::setUpParam(float c0, float c1, float c2)
 {
     if (c0 == c1 && c0 == c2)
     {
-        // If this is a constant, we can skip interpolation.
-        fParameters[fNumParams].isConstant = true;
-        fParameters[fNumParams].constantValue = c0;
+        // If this is a constant, the gradients are zero. The pipeline skips
+        // perspective correction, so the value is exact.
+        fPerspectiveMask[fNumParams] = 0;
+        fXGradients[fNumParams] = 0.0f;
+        fYGradients[fNumParams] = 0.0f;
+        fVertex0Values[fNumParams] = c0;
+        fBlockOffsets[fNumParams] = 0.0f;
     }
     else if (fNeedPerspective)
     {
         // Perspective interpolator.
         // These must be divided by Z to be perspective correct, as described above.
-        fParameters[fNumParams].isConstant = false;
-        setUpInterpolator(fParameters[fNumParams].linearInterpolator,
-                          c0 / fZ0, c1 / fZ1, c2 / fZ2);
+        fPerspectiveMask[fNumParams] = 0xffff;
+        setUpInterpolator(fNumParams, c0 / fZ0, c1 / fZ1, c2 / fZ2);
     }
     else
     {
         // Non-perspective interpolator. If all Zs are the same, we can just do linear
         // interpolation and save extra divisions.
-        fParameters[fNumParams].isConstant = false;
-        setUpInterpolator(fParameters[fNumParams].linearInterpolator,
-                          c0, c1, c2);
+        fPerspectiveMask[fNumParams] = 0;
+        setUpInterpolator(fNumParams, c0, c1, c2);
     }
 
     fNumParams++;
 }
 
-void TriangleFiller::fillMasked(int left, int top, vmask_t mask)
+// Convert pixel colors to a color buffer format other than RGBA8888. If
+// blend is set, this blends with the existing contents of the color buffer
+// using premultiplied alpha, like fillPipeline does for RGBA8888.
+vecu16_t TriangleFiller::packColor(const vecf16_t *color, bool blend, int left, int top) const
 {
-    // Convert from raster to screen space coordinates.
-    vecf16_t x = fTarget->getColorBuffer()->getXStep() + (left * fTwoOverWidth - 1.0f);
-    vecf16_t y = 1.0f - top * fTwoOverHeight - fTarget->getColorBuffer()->getYStep();
-
-    // Depth buffer
-    vecf16_t zValues;
-    if (fNeedPerspective)
-        zValues = 1.0f / fOneOverZInterpolator.getValuesAt(x, y);
-    else
-        zValues = fZ0;
-
-    if (fState->fEnableDepthBuffer)
+    const Surface *colorBuffer = fTarget->getColorBuffer();
+    vecf16_t oneMinusA = 0.0f;
+    vecu16_t dest = 0;
+    if (blend)
     {
-        vecf16_t depthBufferValues = vecf16_t(fTarget->getDepthBuffer()->readBlock(left, top));
-        int passDepthTest = __builtin_nyuzi_mask_cmpf_gt(zValues, depthBufferValues);
-
-        // Early Z optimization: any pixels that fail the Z test are removed
-        // from the pixel mask.
-        mask &= passDepthTest;
-        if (mask == 0)
-            return; // All pixels are occluded
-
-        fTarget->getDepthBuffer()->writeBlockMasked(left, top, mask, vecu16_t(zValues));
+        oneMinusA = 1.0f - clamp(color[kColorA], 0.0f, 1.0f);
+        dest = colorBuffer->readBlock(left, top);
     }
 
-    // Interpolate parameters
-    vecf16_t interpolatedParams[kMaxParams];
-    for (int paramIndex = 0; paramIndex < fNumParams; paramIndex++)
+    // R32F is not clamped, so it can hold values outside 0.0-1.0.
+    // The casts do not perform conversions.
+    if (fColorFormat == kR32F)
+        return vecu16_t(color[kColorR] + vecf16_t(dest) * oneMinusA);
+
+    vecf16_t r = clamp(color[kColorR], 0.0f, 1.0f);
+    if (fColorFormat == kRGB565)
     {
-        if (fParameters[paramIndex].isConstant)
-            interpolatedParams[paramIndex] = fParameters[paramIndex].constantValue;
-        else if (fNeedPerspective)
-        {
-            interpolatedParams[paramIndex] = fParameters[paramIndex].linearInterpolator
-                                             .getValuesAt(x, y) * zValues;
-        }
-        else
+        vecf16_t g = clamp(color[kColorG], 0.0f, 1.0f);
+        vecf16_t b = clamp(color[kColorB], 0.0f, 1.0f);
+        if (blend)
         {
-            interpolatedParams[paramIndex] = fParameters[paramIndex].linearInterpolator
-                                             .getValuesAt(x, y);
+            r = min(r + __builtin_convertvector((dest >> 11) & 31, vecf16_t) * (1.0f / 31.0f)
+                    * oneMinusA, vecf16_t(1.0f));
+            g = min(g + __builtin_convertvector((dest >> 5) & 63, vecf16_t) * (1.0f / 63.0f)
+                    * oneMinusA, vecf16_t(1.0f));
+            b = min(b + __builtin_convertvector(dest & 31, vecf16_t) * (1.0f / 31.0f)
+                    * oneMinusA, vecf16_t(1.0f));
         }
-    }
-
-    // Shade
-    vecf16_t color[4];
-    fState->fShader->shadePixels(color, interpolatedParams, fState->fUniforms, fState->fTextures,
-                                 mask);
-
-    // Convert color channels to 8bpp
-    vecu16_t rS = __builtin_convertvector(clamp(color[kColorR], 0.0, 1.0) * 255.0f, vecu16_t);
-    vecu16_t gS = __builtin_convertvector(clamp(color[kColorG], 0.0, 1.0) * 255.0f, vecu16_t);
-    vecu16_t bS = __builtin_convertvector(clamp(color[kColorB], 0.0, 1.0) * 255.0f, vecu16_t);
 
-    vecu16_t pixelValues;
+        return (__builtin_convertvector(r * 31.0f, vecu16_t) << 11)
+               | (__builtin_convertvector(g * 63.0f, vecu16_t) << 5)
+               | __builtin_convertvector(b * 31.0f, vecu16_t);
+    }
 
-    // If all pixels are fully opaque, don't bother trying to blend them.
-    if (fState->fEnableBlend
-            && (__builtin_nyuzi_mask_cmpf_lt(color[kColorA], vecf16_t(1.0f)) & mask) != 0)
+    const float maxValue = fColorFormat == kR8 ? 255.0f : 65535.0f;
+    if (blend)
     {
-        vecu16_t aS = __builtin_convertvector(clamp(color[kColorA], 0.0, 1.0) * 255.0f, vecu16_t)
-                      & 0xff;
-        vecu16_t oneMinusAS = 255 - aS;
-
-        vecu16_t destColors = vecu16_t(fTarget->getColorBuffer()->readBlock(left, top));
-        vecu16_t rD = destColors & 0xff;
-        vecu16_t gD = (destColors >> 8) & 0xff;
-        vecu16_t bD = (destColors >> 16) & 0xff;
-
-        // Premultiplied alpha
-        vecu16_t newR = saturate(((rS << 8) + (rD * oneMinusAS)) >> 8, 255);
-        vecu16_t newG = saturate(((gS << 8) + (gD * oneMinusAS)) >> 8, 255);
-        vecu16_t newB = saturate(((bS << 8) + (bD * oneMinusAS)) >> 8, 255);
-        pixelValues = 0xff000000 | newR | (newG << 8) | (newB << 16);
+        r = min(r + __builtin_convertvector(dest, vecf16_t) * (1.0f / maxValue) * oneMinusA,
+                vecf16_t(1.0f));
     }
-    else
-        pixelValues = 0xff000000 | rS | (gS << 8) | (bS << 16);
 
-    fTarget->getColorBuffer()->writeBlockMasked(left, top, mask, vecu16_t(pixelValues));
+    return __builtin_convertvector(r * maxValue, vecu16_t);
 }
 
 } // namespace librender
-
@@ -18,7 +18,6 @@
 #pragma once
 
 #include <stdint.h>
-#include "LinearInterpolator.h"
 #include "RenderState.h"
 #include "RenderTarget.h"
 #include "Shader.h"
@@ -28,11 +27,20 @@ namespace librender
 
 const int kMaxParams = 16;
 
+// Maximum number of parameters that are interpolated across a triangle. The
+// position (x, y, z, w) is not interpolated.
+const int kMaxInterpolatedParams = kMaxParams - 4;
+
 //
 // This delegate shades pixels and writes them to the render target.
 // It maintains state for one triangle at a time. The rasterizer calls
 // it for each 4x4 batch of pixels.
 //
+// Rather than checking the render state for each block, setUpTriangle
+// chooses a pixel pipeline, which is a version of fillPipeline specialized
+// for that state. Shaders that derive from InlineShader get pipelines that
+// call their shadePixels method directly so it can be inlined.
+//
 class TriangleFiller
 {
 public:
@@ -44,7 +52,10 @@ public:
     // The rasterizer calls this to fill a 4x4 block.  The left and top
     // coordinates are raster coordinates (count of pixels from the upper
     // left corner).
-    void fillMasked(int left, int top, vmask_t mask);
+    void fillMasked(int left, int top, vmask_t mask)
+    {
+        (this->*fPipeline)(left, top, mask);
+    }
 
     // This is called before setUpParam. The coordinates represent the
     // on-screen position of the triangle.
@@ -58,32 +69,137 @@ public:
     // parameter at each of the three triangle points.
     void setUpParam(float c1, float c2, float c3);
 
+    // Number of pixels this has shaded and removed with the depth test
+    // since it was created.
+    int getPixelsShaded() const
+    {
+        return fPixelsShaded;
+    }
+
+    int getPixelsDepthRejected() const
+    {
+        return fPixelsDepthRejected;
+    }
+
+    // Return the pipeline instance for ShaderType that matches the passed
+    // state. If ShaderType is Shader, the pipeline calls shadePixels through
+    // the vtable.
+    template <class ShaderType, int kNumParams>
+    static PixelPipeline selectPipeline(DepthMode depthMode, bool enableBlend, bool perspective)
+    {
+        static const PixelPipeline kPipelines[kNumDepthModes * 4] = {
+            &TriangleFiller::fillPipeline<ShaderType, kDepthDisabled, false, false, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthDisabled, false, true, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthDisabled, true, false, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthDisabled, true, true, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthTestAndWrite, false, false, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthTestAndWrite, false, true, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthTestAndWrite, true, false, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthTestAndWrite, true, true, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthTestEqual, false, false, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthTestEqual, false, true, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthTestEqual, true, false, kNumParams>,
+            &TriangleFiller::fillPipeline<ShaderType, kDepthTestEqual, true, true, kNumParams>
+        };
+
+        return kPipelines[depthMode * 4 | (enableBlend ? 2 : 0) | (perspective ? 1 : 0)];
+    }
+
+    // Passes for rendering a tile with a depth pre-pass. In kDepthOnlyPass,
+    // setUpTriangle selects a pipeline that only updates the depth buffer, so
+    // setUpParam doesn't need to be called. In kShadeVisiblePass, opaque
+    // triangles with depth testing enabled only shade pixels whose depth
+    // equals the value left by the first pass, and that no earlier triangle
+    // has shaded, so ties go to the first triangle drawn, as they do with the
+    // normal test. setShadedMasks must be called before this pass.
+    enum Pass
+    {
+        kSinglePass,
+        kDepthOnlyPass,
+        kShadeVisiblePass
+    };
+
+    void setPass(Pass pass)
+    {
+        fPass = pass;
+    }
+
+    // masks records which pixels kShadeVisiblePass has shaded, with one mask
+    // for each 4x4 block of a tileSize x tileSize tile, in row major order.
+    // It must be zeroed before the pass starts.
+    void setShadedMasks(vmask_t *masks, int tileSize)
+    {
+        fShadedMasks = masks;
+        fTileMask = tileSize - 1;
+        fBlockRowShift = __builtin_ctz(static_cast<unsigned int>(tileSize)) - 2;
+    }
+
 private:
-    void setUpInterpolator(LinearInterpolator &interpolator, float c0, float c1,
-                           float c2);
+    void setUpInterpolator(int lane, float c0, float c1, float c2);
+
+    // Return the value of each interpolant at the upper left pixel of the
+    // 4x4 block at left, top.
+    vecf16_t getBlockValues(int left, int top) const
+    {
+        return fVertex0Values + fXGradients * (left - fRasterX0) + fYGradients * (top - fRasterY0);
+    }
+
+    template <class ShaderType, DepthMode kDepthMode, bool kEnableBlend, bool kPerspective,
+              int kNumParams>
+    void fillPipeline(int left, int top, vmask_t mask);
+
+    template <bool kPerspective>
+    void depthOnlyPipeline(int left, int top, vmask_t mask);
+
+    // Compute the values stored in the depth buffer for a block and the mask
+    // of pixels that are in front of (or, if kEqual is set, the same as) the
+    // current contents.
+    template <bool kPerspective, bool kEqual>
+    vmask_t depthTest(int left, int top, vecf16_t oneOverZ, vecf16_t zValues,
+                      vecu16_t &outDepthValues) const;
+
+    vecu16_t packColor(const vecf16_t *color, bool blend, int left, int top) const;
 
     const RenderState *fState = nullptr;
     RenderTarget *fTarget;
+    SurfaceFormat fColorFormat;
+    bool fDepth16;
+    PixelPipeline fPipeline = nullptr;
+    Pass fPass = kSinglePass;
+    vmask_t *fShadedMasks = nullptr;
+    int fTileMask = 0;
+    int fBlockRowShift = 0;
+    int fPixelsShaded = 0;
+    int fPixelsDepthRejected = 0;
 
     // 2.0 divided by the resolution of the screen in pixels. Used to convert
-    // from raster coordinates to screen space (-1.0 to 1.0).
+    // from screen space (-1.0 to 1.0) to raster coordinates.
     float fTwoOverWidth;
     float fTwoOverHeight;
 
-    // Parameter interpolation
-    LinearInterpolator fOneOverZInterpolator;
-    struct
-    {
-        bool isConstant;
-        float constantValue;
-        LinearInterpolator linearInterpolator;
-    } fParameters[kMaxParams];
+    // Interpolated values are stored with one vector lane for each
+    // parameter, plus kOneOverZLane for 1/z. Gradients are in raster space
+    // and values are relative to the first vertex, so getBlockValues finds
+    // the values at the upper left pixel of a block for all of them at once.
+    // fBlockOffsets holds, for each interpolant, the difference from that
+    // pixel to each pixel in a block, so each one only needs an add.
+    static const int kOneOverZLane = kMaxParams - 1;
+    static_assert(kMaxInterpolatedParams <= kOneOverZLane, "1/z lane overlaps parameters");
+    vecf16_t fXGradients;
+    vecf16_t fYGradients;
+    vecf16_t fVertex0Values;
+    vecf16_t fBlockOffsets[kMaxParams];
+
+    // When perspective correction is enabled, interpolated values are
+    // multiplied by Z only for lanes set in the parameter's mask, which is
+    // all or nothing. This keeps constant values exact without a branch.
+    vmask_t fPerspectiveMask[kMaxParams];
     int fNumParams = 0;
+    float fRasterX0;
+    float fRasterY0;
     float fZ0;
     float fZ1;
     float fZ2;
-    float fX0;
-    float fY0;
     bool fNeedPerspective;
 
     // Inverse gradient matrix
@@ -93,4 +209,177 @@ private:
     float fInvGradientMatrix11;
 };
 
+// Call the pixel shader. Calling through a qualified name on the concrete
+// type bypasses the vtable, which allows the compiler to inline it.
+template <class ShaderType>
+inline void callShadePixels(const Shader *shader, vecf16_t *outColor, const vecf16_t *inParams,
+                            const void *uniforms, const Texture * const * sampler,
+                            vmask_t mask)
+{
+    static_cast<const ShaderType*>(shader)->ShaderType::shadePixels(outColor, inParams, uniforms,
+            sampler, mask);
+}
+
+template <>
+inline void callShadePixels<Shader>(const Shader *shader, vecf16_t *outColor,
+                                    const vecf16_t *inParams, const void *uniforms,
+                                    const Texture * const * sampler, vmask_t mask)
+{
+    shader->shadePixels(outColor, inParams, uniforms, sampler, mask);
+}
+
+template <bool kPerspective, bool kEqual>
+vmask_t TriangleFiller::depthTest(int left, int top, vecf16_t oneOverZ, vecf16_t zValues,
+                                  vecu16_t &outDepthValues) const
+{
+    const Surface *depthBuffer = fTarget->getDepthBuffer();
+    if (fDepth16)
+    {
+        // This is -1/z, clamped to [0, 1] and scaled to 16 bits.
+        const vecf16_t negOneOverZ = kPerspective ? -oneOverZ : vecf16_t(-1.0f / fZ0);
+        outDepthValues = __builtin_convertvector(clamp(negOneOverZ, 0.0f, 1.0f) * 65535.0f,
+                         vecu16_t);
+        const vecu16_t current = depthBuffer->readBlock(left, top);
+        return kEqual ? __builtin_nyuzi_mask_cmpi_eq(outDepthValues, current)
+               : __builtin_nyuzi_mask_cmpi_ugt(outDepthValues, current);
+    }
+
+    // The casts do not perform conversions.
+    outDepthValues = vecu16_t(zValues);
+    const vecf16_t current = vecf16_t(depthBuffer->readBlock(left, top));
+    return kEqual ? __builtin_nyuzi_mask_cmpf_eq(zValues, current)
+           : __builtin_nyuzi_mask_cmpf_gt(zValues, current);
+}
+
+template <bool kPerspective>
+void TriangleFiller::depthOnlyPipeline(int left, int top, vmask_t mask)
+{
+    vecf16_t oneOverZ = 0.0f;
+    vecf16_t zValues = fZ0;
+    if (kPerspective)
+    {
+        oneOverZ = fBlockOffsets[kOneOverZLane] + getBlockValues(left, top)[kOneOverZLane];
+
+        // 16-bit depth buffers store -1/z, so don't need the reciprocal
+        if (!fDepth16)
+            zValues = 1.0f / oneOverZ;
+    }
+
+    vecu16_t depthValues;
+    mask &= depthTest<kPerspective, false>(left, top, oneOverZ, zValues, depthValues);
+    if (mask)
+        fTarget->getDepthBuffer()->writeBlockMasked(left, top, mask, depthValues);
+}
+
+template <class ShaderType, DepthMode kDepthMode, bool kEnableBlend, bool kPerspective,
+          int kNumParams>
+void TriangleFiller::fillPipeline(int left, int top, vmask_t mask)
+{
+    const vecf16_t blockValues = getBlockValues(left, top);
+
+    // Depth buffer. Z is only needed before the depth test if the depth
+    // buffer stores it. Otherwise, the reciprocal is skipped for blocks that
+    // are occluded.
+    vecf16_t oneOverZ;
+    vecf16_t zValues = fZ0;
+    const bool depthTestUsesZ = kDepthMode != kDepthDisabled && !fDepth16;
+    if (kPerspective)
+    {
+        oneOverZ = fBlockOffsets[kOneOverZLane] + blockValues[kOneOverZLane];
+        if (depthTestUsesZ)
+            zValues = 1.0f / oneOverZ;
+    }
+
+    if (kDepthMode != kDepthDisabled)
+    {
+        vecu16_t depthValues;
+        const vmask_t passDepthTest = depthTest<kPerspective, kDepthMode == kDepthTestEqual>(
+                                          left, top, oneOverZ, zValues, depthValues);
+
+        // Early Z optimization: any pixels that fail the Z test are removed
+        // from the pixel mask.
+        const int numCovered = __builtin_popcount(mask);
+        mask &= passDepthTest;
+        if (kDepthMode == kDepthTestEqual)
+        {
+            vmask_t &shaded = fShadedMasks[(((top & fTileMask) >> 2) << fBlockRowShift)
+                                           + ((left & fTileMask) >> 2)];
+            mask &= ~shaded;
+            shaded |= mask;
+        }
+
+        fPixelsDepthRejected += numCovered - __builtin_popcount(mask);
+        if (mask == 0)
+            return; // All pixels are occluded
+
+        if (kDepthMode == kDepthTestAndWrite)
+            fTarget->getDepthBuffer()->writeBlockMasked(left, top, mask, depthValues);
+    }
+
+    if (kPerspective && kNumParams > 0 && !depthTestUsesZ)
+        zValues = 1.0f / oneOverZ;
+
+    // Interpolate parameters
+    vecf16_t interpolatedParams[kNumParams > 0 ? kNumParams : 1];
+    if (kNumParams == 0)
+        interpolatedParams[0] = 0.0f;   // Placeholder, so the shader never reads garbage
+
+    for (int paramIndex = 0; paramIndex < kNumParams; paramIndex++)
+    {
+        const vecf16_t value = fBlockOffsets[paramIndex] + blockValues[paramIndex];
+        if (kPerspective)
+        {
+            interpolatedParams[paramIndex] = __builtin_nyuzi_vector_mixf(
+                fPerspectiveMask[paramIndex], value * zValues, value);
+        }
+        else
+            interpolatedParams[paramIndex] = value;
+    }
+
+    // Shade
+    fPixelsShaded += __builtin_popcount(mask);
+    vecf16_t color[4];
+    callShadePixels<ShaderType>(fState->fShader, color, interpolatedParams, fState->fUniforms,
+                                fState->fTextures, mask);
+
+    // If all pixels are fully opaque, don't bother trying to blend them.
+    const bool blend = kEnableBlend
+                       && (__builtin_nyuzi_mask_cmpf_lt(color[kColorA], vecf16_t(1.0f)) & mask) != 0;
+    if (fColorFormat != kRGBA8888)
+    {
+        fTarget->getColorBuffer()->writeBlockMasked(left, top, mask,
+                packColor(color, blend, left, top));
+        return;
+    }
+
+    // Convert color channels to 8bpp
+    vecu16_t rS = __builtin_convertvector(clamp(color[kColorR], 0.0, 1.0) * 255.0f, vecu16_t);
+    vecu16_t gS = __builtin_convertvector(clamp(color[kColorG], 0.0, 1.0) * 255.0f, vecu16_t);
+    vecu16_t bS = __builtin_convertvector(clamp(color[kColorB], 0.0, 1.0) * 255.0f, vecu16_t);
+
+    vecu16_t pixelValues;
+
+    if (blend)
+    {
+        vecu16_t aS = __builtin_convertvector(clamp(color[kColorA], 0.0, 1.0) * 255.0f, vecu16_t)
+                      & 0xff;
+        vecu16_t oneMinusAS = 255 - aS;
+
+        vecu16_t destColors = vecu16_t(fTarget->getColorBuffer()->readBlock(left, top));
+        vecu16_t rD = destColors & 0xff;
+        vecu16_t gD = (destColors >> 8) & 0xff;
+        vecu16_t bD = (destColors >> 16) & 0xff;
+
+        // Premultiplied alpha
+        vecu16_t newR = saturate(((rS << 8) + (rD * oneMinusAS)) >> 8, 255);
+        vecu16_t newG = saturate(((gS << 8) + (gD * oneMinusAS)) >> 8, 255);
+        vecu16_t newB = saturate(((bS << 8) + (bD * oneMinusAS)) >> 8, 255);
+        pixelValues = 0xff000000 | newR | (newG << 8) | (newB << 16);
+    }
+    else
+        pixelValues = 0xff000000 | rS | (gS << 8) | (bS << 16);
+
+    fTarget->getColorBuffer()->writeBlockMasked(left, top, mask, vecu16_t(pixelValues));
+}
+
 } // namespace librender
@@ -0,0 +1,95 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace librender
+{
+
+//
+// UniformBuffer holds a copy of values that are passed to shaders, which
+// persists across frames. Unlike RenderContext::bindUniforms with a
+// pointer, which copies the values for every call, this is only copied when
+// update is called, and draw calls reference it by pointer.
+//
+// It is reference counted: it starts with one reference, which belongs to
+// the creator, and RenderContext adds one while it is bound and for each
+// queued draw call that uses it. When the last reference is released, it
+// is deleted. References are only changed by the thread that submits
+// rendering commands.
+//
+// Shaders read the values while RenderContext::finish runs, so all draw
+// calls in a frame see the contents from the last update before finish.
+// Values that change between draw calls in the same frame need separate
+// buffers.
+//
+
+class UniformBuffer
+{
+public:
+    explicit UniformBuffer(size_t size)
+        :	fData(malloc(size)),
+            fSize(size)
+    {
+        memset(fData, 0, size);
+    }
+
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    void update(const void *data)
+    {
+        memcpy(fData, data, fSize);
+    }
+
+    const void *getData() const
+    {
+        return fData;
+    }
+
+    size_t getSize() const
+    {
+        return fSize;
+    }
+
+    void addRef()
+    {
+        fRefCount++;
+    }
+
+    void release()
+    {
+        assert(fRefCount > 0);
+        if (--fRefCount == 0)
+            delete this;
+    }
+
+private:
+    ~UniformBuffer()
+    {
+        free(fData);
+    }
+
+    void *fData;
+    size_t fSize;
+    int fRefCount = 1;
+};
+
+} // namespace librender
@@ -0,0 +1,36 @@
+#
+# Copyright 2011-2015 Jeff Bush
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+#
+# This is included by makefiles that compile librender, or programs that use
+# it, to run natively on the host machine. TOPDIR must be set first.
+#
+
+HOST_RENDER_DIR=$(TOPDIR)/software/libs/librender/host
+HOST_CXX=g++
+
+# The host include directory comes first so its stdint.h and stdlib.h
+# wrap the host's. libos is searched last, after the host's system
+# headers, because it also has headers like unistd.h. -faligned-new honors
+# the 64 byte alignment of classes with vector members, which C++11
+# operator new doesn't.
+HOST_RENDER_CFLAGS=-O3 -g -std=c++11 -fno-rtti -ffast-math -faligned-new -Wno-psabi \
+	-I$(HOST_RENDER_DIR)/include \
+	-I$(TOPDIR)/software/libs/librender \
+	-idirafter $(TOPDIR)/software/libs/libos
+
+# -no-pie keeps addresses in the low 2GB (see host/runtime.cpp)
+HOST_RENDER_LIBS=-no-pie $(HOST_RENDER_DIR)/librender.a -pthread
@@ -0,0 +1,322 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <string.h>
+#include <initializer_list>
+#include <type_traits>
+
+//
+// Emulates the Nyuzi vector types and compiler builtins with GCC vector
+// extensions, so code written for Nyuzi can be compiled for the host.
+// GCC lowers 16 lane vector operations to the widest SIMD instructions the
+// host supports (-mavx2, -march=native, etc.).
+//
+// Clang's ext_vector_type can be initialized from a scalar, which is copied
+// to all lanes, and converted to any other vector type of the same size,
+// which reinterprets the bits. GCC vector types can't, so the vector types
+// here are thin wrappers that add those conversions.
+//
+// Vector lanes hold 32 bit addresses for gathers and scatters. The host
+// runtime (host/runtime.cpp) keeps the heap below 2GB so pointers survive
+// the round trip through an int.
+//
+
+typedef unsigned short vmask_t;
+
+namespace nyuzi_host
+{
+
+template <typename T>
+struct Vector
+{
+    typedef T Native __attribute__((vector_size(16 * sizeof(T))));
+    typedef T Element;
+
+    Vector() = default;
+
+    template <typename S, typename = typename std::enable_if<std::is_arithmetic<S>::value>::type>
+    Vector(S scalar)
+        :	v(Native{} + static_cast<T>(scalar))
+    {
+    }
+
+    Vector(std::initializer_list<T> values)
+        :	v()
+    {
+        int lane = 0;
+        for (T value : values)
+            v[lane++] = value;
+    }
+
+    template <typename U>
+    Vector(const Vector<U> &other)
+    {
+        static_assert(sizeof(other) == sizeof(*this), "vector size mismatch");
+        memcpy(&v, &other.v, sizeof(v));
+    }
+
+    T &operator[](int lane)
+    {
+        return reinterpret_cast<T*>(&v)[lane];
+    }
+
+    T operator[](int lane) const
+    {
+        return v[lane];
+    }
+
+    Vector operator-() const
+    {
+        Vector result;
+        result.v = -v;
+        return result;
+    }
+
+    Vector operator~() const
+    {
+        Vector result;
+        result.v = ~v;
+        return result;
+    }
+
+    Native v;
+};
+
+template <typename T, typename S>
+using EnableIfScalar = typename std::enable_if<std::is_arithmetic<S>::value, Vector<T>>::type;
+
+#define NYUZI_HOST_OPERATOR(op) \
+    template <typename T> \
+    inline Vector<T> operator op(const Vector<T> &a, const Vector<T> &b) \
+    { \
+        Vector<T> result; \
+        result.v = a.v op b.v; \
+        return result; \
+    } \
+    template <typename T, typename S> \
+    inline EnableIfScalar<T, S> operator op(const Vector<T> &a, S b) \
+    { \
+        return a op Vector<T>(b); \
+    } \
+    template <typename T, typename S> \
+    inline EnableIfScalar<T, S> operator op(S a, const Vector<T> &b) \
+    { \
+        return Vector<T>(a) op b; \
+    } \
+    template <typename T> \
+    inline Vector<T> &operator op##=(Vector<T> &a, const Vector<T> &b) \
+    { \
+        a.v = a.v op b.v; \
+        return a; \
+    } \
+    template <typename T, typename S> \
+    inline EnableIfScalar<T, S> &operator op##=(Vector<T> &a, S b) \
+    { \
+        return a op##= Vector<T>(b); \
+    }
+
+NYUZI_HOST_OPERATOR(+)
+NYUZI_HOST_OPERATOR(-)
+NYUZI_HOST_OPERATOR(*)
+NYUZI_HOST_OPERATOR(/)
+NYUZI_HOST_OPERATOR(%)
+NYUZI_HOST_OPERATOR(&)
+NYUZI_HOST_OPERATOR(|)
+NYUZI_HOST_OPERATOR(^)
+NYUZI_HOST_OPERATOR(<<)
+NYUZI_HOST_OPERATOR(>>)
+
+#undef NYUZI_HOST_OPERATOR
+
+// Lanes are all ones where the corresponding mask bit is set.
+inline Vector<int>::Native maskToLanes(vmask_t mask)
+{
+    const Vector<int>::Native kLaneBits = {
+        0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+        0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000
+    };
+
+    return (kLaneBits & static_cast<int>(mask)) != 0;
+}
+
+inline vmask_t lanesToMask(Vector<int>::Native lanes)
+{
+    unsigned int mask = 0;
+    for (int lane = 0; lane < 16; lane++)
+    {
+        if (lanes[lane])
+            mask |= 1u << lane;
+    }
+
+    return static_cast<vmask_t>(mask);
+}
+
+template <typename To, typename From>
+inline To convertVector(const Vector<From> &in)
+{
+    To result;
+    result.v = __builtin_convertvector(in.v, typename To::Native);
+    return result;
+}
+
+template <typename T>
+inline T *laneAddress(int address)
+{
+    return reinterpret_cast<T*>(static_cast<uintptr_t>(static_cast<unsigned int>(address)));
+}
+
+} // namespace nyuzi_host
+
+typedef nyuzi_host::Vector<int> veci16_t;
+typedef nyuzi_host::Vector<unsigned int> vecu16_t;
+typedef nyuzi_host::Vector<float> vecf16_t;
+
+#define __builtin_convertvector(vec, type) (nyuzi_host::convertVector<type>(vec))
+
+#define NYUZI_HOST_COMPARE(name, type, op) \
+    inline vmask_t __builtin_nyuzi_mask_##name(type a, type b) \
+    { \
+        return nyuzi_host::lanesToMask(a.v op b.v); \
+    }
+
+NYUZI_HOST_COMPARE(cmpf_gt, vecf16_t, >)
+NYUZI_HOST_COMPARE(cmpf_ge, vecf16_t, >=)
+NYUZI_HOST_COMPARE(cmpf_lt, vecf16_t, <)
+NYUZI_HOST_COMPARE(cmpf_le, vecf16_t, <=)
+NYUZI_HOST_COMPARE(cmpf_eq, vecf16_t, ==)
+NYUZI_HOST_COMPARE(cmpf_ne, vecf16_t, !=)
+NYUZI_HOST_COMPARE(cmpi_sgt, veci16_t, >)
+NYUZI_HOST_COMPARE(cmpi_sge, veci16_t, >=)
+NYUZI_HOST_COMPARE(cmpi_slt, veci16_t, <)
+NYUZI_HOST_COMPARE(cmpi_sle, veci16_t, <=)
+NYUZI_HOST_COMPARE(cmpi_eq, veci16_t, ==)
+NYUZI_HOST_COMPARE(cmpi_ne, veci16_t, !=)
+NYUZI_HOST_COMPARE(cmpi_ugt, vecu16_t, >)
+NYUZI_HOST_COMPARE(cmpi_uge, vecu16_t, >=)
+NYUZI_HOST_COMPARE(cmpi_ult, vecu16_t, <)
+NYUZI_HOST_COMPARE(cmpi_ule, vecu16_t, <=)
+
+#undef NYUZI_HOST_COMPARE
+
+inline veci16_t __builtin_nyuzi_vector_mixi(vmask_t mask, veci16_t a, veci16_t b)
+{
+    veci16_t result;
+    result.v = nyuzi_host::maskToLanes(mask) ? a.v : b.v;
+    return result;
+}
+
+inline vecf16_t __builtin_nyuzi_vector_mixf(vmask_t mask, vecf16_t a, vecf16_t b)
+{
+    vecf16_t result;
+    result.v = nyuzi_host::maskToLanes(mask) ? a.v : b.v;
+    return result;
+}
+
+inline veci16_t __builtin_nyuzi_shufflei(veci16_t a, veci16_t indices)
+{
+    veci16_t result;
+    result.v = __builtin_shuffle(a.v, indices.v & 15);
+    return result;
+}
+
+inline vecf16_t __builtin_nyuzi_shufflef(vecf16_t a, veci16_t indices)
+{
+    vecf16_t result;
+    result.v = __builtin_shuffle(a.v, indices.v & 15);
+    return result;
+}
+
+// Masked off lanes are zero here. Code for Nyuzi shouldn't rely on that.
+inline veci16_t __builtin_nyuzi_gather_loadi_masked(veci16_t ptrs, vmask_t mask)
+{
+    veci16_t result = 0;
+    for (int lane = 0; lane < 16; lane++)
+    {
+        if (mask & (1 << lane))
+            result[lane] = *nyuzi_host::laneAddress<const int>(ptrs[lane]);
+    }
+
+    return result;
+}
+
+inline veci16_t __builtin_nyuzi_gather_loadi(veci16_t ptrs)
+{
+    return __builtin_nyuzi_gather_loadi_masked(ptrs, 0xffff);
+}
+
+inline vecf16_t __builtin_nyuzi_gather_loadf_masked(veci16_t ptrs, vmask_t mask)
+{
+    return __builtin_nyuzi_gather_loadi_masked(ptrs, mask);
+}
+
+inline vecf16_t __builtin_nyuzi_gather_loadf(veci16_t ptrs)
+{
+    return __builtin_nyuzi_gather_loadi_masked(ptrs, 0xffff);
+}
+
+inline void __builtin_nyuzi_scatter_storei_masked(veci16_t ptrs, veci16_t values, vmask_t mask)
+{
+    for (int lane = 0; lane < 16; lane++)
+    {
+        if (mask & (1 << lane))
+            *nyuzi_host::laneAddress<int>(ptrs[lane]) = values[lane];
+    }
+}
+
+inline void __builtin_nyuzi_scatter_storei(veci16_t ptrs, veci16_t values)
+{
+    __builtin_nyuzi_scatter_storei_masked(ptrs, values, 0xffff);
+}
+
+inline void __builtin_nyuzi_scatter_storef_masked(veci16_t ptrs, vecf16_t values, vmask_t mask)
+{
+    __builtin_nyuzi_scatter_storei_masked(ptrs, values, mask);
+}
+
+inline void __builtin_nyuzi_scatter_storef(veci16_t ptrs, vecf16_t values)
+{
+    __builtin_nyuzi_scatter_storei_masked(ptrs, values, 0xffff);
+}
+
+inline void __builtin_nyuzi_block_storei_masked(veci16_t *ptr, veci16_t values, vmask_t mask)
+{
+    for (int lane = 0; lane < 16; lane++)
+    {
+        if (mask & (1 << lane))
+            (*ptr)[lane] = values[lane];
+    }
+}
+
+inline void __builtin_nyuzi_block_storef_masked(vecf16_t *ptr, vecf16_t values, vmask_t mask)
+{
+    for (int lane = 0; lane < 16; lane++)
+    {
+        if (mask & (1 << lane))
+            (*ptr)[lane] = values[lane];
+    }
+}
+
+// There are no control registers on the host. Reads return zero.
+inline int __builtin_nyuzi_read_control_reg(int)
+{
+    return 0;
+}
+
+inline void __builtin_nyuzi_write_control_reg(int, int)
+{
+}
@@ -14,39 +14,16 @@
 // limitations under the License.
 //
 
-
 #pragma once
 
-#include "SIMDMath.h"
-
-namespace librender
-{
-
 //
-// 2D linear interpolator.
+// On Nyuzi, libc's stdint.h defines the vector types. In the host build,
+// this header comes first in the include path, so it adds them to the
+// host's stdint.h.
 //
 
-class LinearInterpolator
-{
-public:
-    void init(float xGradient, float yGradient, float c00)
-    {
-        fXGradient = xGradient;
-        fYGradient = yGradient;
-        fC00 = c00;
-    }
-
-    // Return values of this parameter at 16 locations given by the vectors
-    // x and y.
-    inline vecf16_t getValuesAt(vecf16_t x, vecf16_t y) const
-    {
-        return x * fXGradient + y * fYGradient + fC00;
-    }
-
-private:
-    float fXGradient;
-    float fYGradient;
-    float fC00;	// Value of C at 0, 0
-};
+#include_next <stdint.h>
 
-} // namespace librender
+#ifdef __cplusplus
+#include "nyuzi_vector.h"
+#endif
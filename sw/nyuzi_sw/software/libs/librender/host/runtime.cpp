@@ -0,0 +1,123 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//
+// Host implementations of the libos functions librender uses. Worker
+// threads are host threads, the cycle counter counts nanoseconds, and
+// performance counters read as zero.
+//
+
+#include <malloc.h>
+#include <nyuzi.h>
+#include <performance_counters.h>
+#include <schedule.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+thread_local int gThreadId = 0;
+
+// librender stores addresses in 32 bit vector lanes. Programs are linked
+// with -no-pie, which puts code, data and the sbrk heap at low addresses.
+// Keep large allocations and other threads' allocations on the sbrk heap
+// too, instead of in mmapped memory, which is placed near the top of the
+// address space.
+__attribute__((constructor(101))) void initHeap()
+{
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_ARENA_MAX, 1);
+    if (reinterpret_cast<uintptr_t>(sbrk(0)) >= 0x80000000u)
+    {
+        fprintf(stderr, "heap is not in the low 2GB of the address space, link with -no-pie\n");
+        abort();
+    }
+}
+
+int getNumThreads()
+{
+    const char *env = getenv("RENDER_THREADS");
+    if (env != nullptr)
+        return atoi(env) > 0 ? atoi(env) : 1;
+
+    const int numCpus = static_cast<int>(std::thread::hardware_concurrency());
+    return numCpus > 0 ? numCpus : 1;
+}
+
+} // namespace
+
+int get_current_thread_id(void)
+{
+    return gThreadId;
+}
+
+unsigned int get_cycle_count(void)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<unsigned int>(static_cast<unsigned long long>(now.tv_sec) * 1000000000ull
+                                     + static_cast<unsigned long long>(now.tv_nsec));
+}
+
+void set_perf_counter_event(int, enum performance_event)
+{
+}
+
+unsigned int read_perf_counter(int)
+{
+    return 0;
+}
+
+// Host threads are started by parallel_execute.
+void start_all_threads(void)
+{
+}
+
+// Programs call this on threads other than thread 0, which don't exist
+// when main runs on the host.
+void worker_thread(void)
+{
+    abort();
+}
+
+// Like the libos version, the calling thread is thread 0 and works on the
+// job along with the others.
+void parallel_execute(parallel_func_t func, void *context, int num_elements)
+{
+    static const int kNumThreads = getNumThreads();
+    std::atomic<int> nextIndex(0);
+    auto worker = [&](int threadId)
+    {
+        gThreadId = threadId;
+        int index;
+        while ((index = nextIndex++) < num_elements)
+            func(context, index);
+    };
+
+    std::vector<std::thread> threads;
+    for (int threadId = 1; threadId < kNumThreads; threadId++)
+        threads.emplace_back(worker, threadId);
+
+    worker(0);
+    for (std::thread &thread : threads)
+        thread.join();
+}
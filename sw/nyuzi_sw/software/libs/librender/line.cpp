@@ -14,7 +14,9 @@
 // limitations under the License.
 //
 
+#include <stdlib.h>
 #include "line.h"
+#include "SIMDMath.h"
 
 namespace librender
 {
@@ -22,180 +24,90 @@ namespace librender
 namespace
 {
 
-// Clip masks
-const unsigned int kBottom = 1;
-const unsigned int kTop = 2;
-const unsigned int kLeft = 4;
-const unsigned int kRight = 8;
+const veci16_t kLaneIndex = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
 
-inline int vertClip(int x1, int y1, int x2, int y2, int x)
-{
-    return y1 + (x - x1) * (y2 - y1) / (x2 - x1);
-}
-
-inline int horzClip(int x1, int y1, int x2, int y2, int y)
-{
-    return x1 + (y - y1) * (x2 - x1) / (y2 - y1);
-}
-
-inline unsigned int clipmask(int x, int y, int left, int top, int right, int bottom)
-{
-    unsigned mask = 0;
-
-    if (x < left)
-        mask |= kLeft;
-    else if (x > right)
-        mask |= kRight;
-
-    if (y < top)
-        mask |= kTop;
-    else if (y > bottom)
-        mask |= kBottom;
-
-    return mask;
-}
+// Lines are drawn on the edges of triangles, so they are at about the same
+// depth as the triangle's pixels. To keep triangles from hiding their own
+// edges, a line pixel is visible if its -1/z is within this fraction of the
+// depth buffer's value.
+const float kLineDepthBias = 1.0f / 64;
 
 } // namespace
 
-// Cohen/Sutherland line clipping
-void drawLineClipped(Surface *dest, int x1, int y1, int x2, int y2, unsigned int color,
-                     int left, int top, int right, int bottom)
+void drawLineVector(Surface *dest, const Surface *depthBuffer, int x1, int y1, float z1,
+                    int x2, int y2, float z2, unsigned int color,
+                    int left, int top, int right, int bottom)
 {
-    int clippedX1 = x1;
-    int clippedY1 = y1;
-    int clippedX2 = x2;
-    int clippedY2 = y2;
-
-    unsigned point1mask = clipmask(clippedX1, clippedY1, left, top, right, bottom);
-    unsigned point2mask = clipmask(clippedX2, clippedY2, left, top, right, bottom);
-
-    bool rejected = false;
-    while (point1mask != 0 || point2mask != 0)
+    // Step one pixel at a time along the major axis, and compute the
+    // position on the minor axis for each step.
+    const int deltaX = x2 - x1;
+    const int deltaY = y2 - y1;
+    const bool xMajor = abs(deltaX) >= abs(deltaY);
+    const int length = xMajor ? abs(deltaX) : abs(deltaY);
+    const int majorStart = xMajor ? x1 : y1;
+    const int majorDir = (xMajor ? deltaX : deltaY) < 0 ? -1 : 1;
+    const int majorLow = xMajor ? left : top;
+    const int majorHigh = xMajor ? right : bottom;
+    const int minorLow = xMajor ? top : left;
+    const int minorHigh = xMajor ? bottom : right;
+
+    // Clip the range of steps to the part along the major axis that is
+    // inside the rectangle. This limits the loop below to a few batches,
+    // even for long lines.
+    int firstStep = majorDir > 0 ? majorLow - majorStart : majorStart - majorHigh;
+    int lastStep = majorDir > 0 ? majorHigh - majorStart : majorStart - majorLow;
+    firstStep = max(firstStep, 0);
+    lastStep = min(lastStep, length);
+    if (firstStep > lastStep)
+        return;
+
+    // Minor axis position in 16.16 fixed point, rounded to the nearest pixel.
+    // Coordinates are within the guard band, so this doesn't overflow.
+    const int minorStart = (xMajor ? y1 : x1) * 65536 + 32768;
+    const int minorStep = length > 0 ? (xMajor ? deltaY : deltaX) * 65536 / length : 0;
+
+    // 1/z is linear in screen space.
+    const float oneOverZ1 = 1.0f / z1;
+    const float oneOverZStep = length > 0 ? (1.0f / z2 - oneOverZ1) / length : 0.0f;
+    const vecu16_t colors = color;
+
+    for (int step = firstStep; step <= lastStep; step += 16)
     {
-        if ((point1mask & point2mask) != 0)
-        {
-            rejected = true;
-            break;
-        }
-
-        unsigned  mask = point1mask ? point1mask : point2mask;
-        int x, y;
-        if (mask & kBottom)
-        {
-            y = bottom;
-            x = horzClip(clippedX1, clippedY1, clippedX2, clippedY2, y);
-        }
-        else if (mask & kTop)
-        {
-            y = top;
-            x = horzClip(clippedX1, clippedY1, clippedX2, clippedY2, y);
-        }
-        else if (mask & kRight)
-        {
-            x = right;
-            y = vertClip(clippedX1, clippedY1, clippedX2, clippedY2, x);
-        }
-        else if (mask & kLeft)
-        {
-            x = left;
-            y = vertClip(clippedX1, clippedY1, clippedX2, clippedY2, x);
-        }
-
-        if (point1mask)
+        const veci16_t stepIndex = kLaneIndex + step;
+        const veci16_t major = stepIndex * majorDir + majorStart;
+        const veci16_t minor = (stepIndex * minorStep + minorStart) >> 16;
+
+        // All pixels in the batch are clipped with one set of compares.
+        // Steps were already clipped on the major axis.
+        vmask_t mask = __builtin_nyuzi_mask_cmpi_sle(stepIndex, veci16_t(lastStep))
+                       & __builtin_nyuzi_mask_cmpi_sge(minor, veci16_t(minorLow))
+                       & __builtin_nyuzi_mask_cmpi_sle(minor, veci16_t(minorHigh));
+        if (!mask)
+            continue;
+
+        const veci16_t x = xMajor ? major : minor;
+        const veci16_t y = xMajor ? minor : major;
+        if (depthBuffer)
         {
-            // Clip point 1
-            point1mask = clipmask(x, y, left, top, right, bottom);
-            clippedX1 = x;
-            clippedY1 = y;
-        }
-        else
-        {
-            // Clip point 2
-            point2mask = clipmask(x, y, left, top, right, bottom);
-            clippedX2 = x;
-            clippedY2 = y;
-        }
-    }
-
-    if (!rejected)
-        drawLine(dest, clippedX1, clippedY1, clippedX2, clippedY2, color);
-}
-
-void drawLine(Surface *dest, int x1, int y1, int x2, int y2, unsigned int color)
-{
-    // Swap if necessary so we always draw top to bottom
-    if (y1 > y2)
-    {
-        int temp = y1;
-        y1 = y2;
-        y2 = temp;
-
-        temp = x1;
-        x1 = x2;
-        x2 = temp;
-    }
-
-    int deltaY = (y2 - y1) + 1;
-    int deltaX = x2 > x1 ? (x2 - x1) + 1 : (x1 - x2) + 1;
-    int xDir = x2 > x1 ? 1 : -1;
-    int error = 0;
-    unsigned int *ptr = (static_cast<unsigned int*>(dest->bits())) + x1 + y1 * dest->getWidth();
-    int stride = dest->getWidth();
-
-    if (deltaX == 0)
-    {
-        // Vertical line
-        for (int y = deltaY; y > 0; y--)
-        {
-            *ptr = color;
-            ptr += stride;
-        }
-    }
-    else if (deltaY == 0)
-    {
-        // Horizontal line
-        for (int x = deltaX; x > 0; x--)
-        {
-            *ptr = color;
-            ptr += xDir;
-        }
-    }
-    else if (deltaX > deltaY)
-    {
-        // Diagonal with horizontal major axis
-        int x = x1;
-        for (;;)
-        {
-            *ptr = color;
-            error += deltaY;
-            if (error > deltaX)
+            // Compare -1/z, because both depth buffer formats can be
+            // converted to it. The cleared value of both converts to zero.
+            const vecf16_t negOneOverZ = -(__builtin_convertvector(stepIndex, vecf16_t)
+                                           * oneOverZStep + oneOverZ1);
+            const veci16_t depthValues = depthBuffer->readPixels(x, y, mask);
+            vecf16_t bufferNegOneOverZ;
+            if (depthBuffer->getFormat() == kR16)
             {
-                ptr += stride;
-                error -= deltaX;
+                bufferNegOneOverZ = __builtin_convertvector(depthValues, vecf16_t)
+                                    * (1.0f / 65535.0f);
             }
+            else
+                bufferNegOneOverZ = -1.0f / vecf16_t(depthValues);	// Cast does not convert
 
-            ptr += xDir;
-            if (x == x2)
-                break;
-
-            x += xDir;
+            mask &= __builtin_nyuzi_mask_cmpf_ge(negOneOverZ * (1.0f + kLineDepthBias),
+                                                 bufferNegOneOverZ);
         }
-    }
-    else
-    {
-        // Diagonal with vertical major axis
-        for (int y = y1; y <= y2; y++)
-        {
-            *ptr = color;
-            error += deltaX;
-            if (error > deltaY)
-            {
-                ptr += xDir;
-                error -= deltaY;
-            }
 
-            ptr += stride;
-        }
+        dest->writePixelsMasked(x, y, mask, colors);
     }
 }
 
@@ -22,8 +22,13 @@
 namespace librender
 {
 
-void drawLineClipped(Surface *dest, int x1, int y1, int x2, int y2, unsigned int color,
-                     int left, int top, int right, int bottom);
-void drawLine(Surface *dest, int x1, int y1, int x2, int y2, unsigned int color);
+// Draw the part of a line that is inside the rectangle left, top, right,
+// bottom (inclusive), which must be no larger than a tile. This computes 16
+// pixels at a time and writes them with a scatter store. z1 and z2 are the
+// clip space Z values at each end. If depthBuffer is not null, pixels that
+// are behind its contents are not drawn.
+void drawLineVector(Surface *dest, const Surface *depthBuffer, int x1, int y1, float z1,
+                    int x2, int y2, float z2, unsigned int color,
+                    int left, int top, int right, int bottom);
 
 } // namespace librender
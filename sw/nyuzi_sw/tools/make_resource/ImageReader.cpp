@@ -0,0 +1,219 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//
+// PNG and JPEG files are decoded with libpng and libjpeg. TGA is simple
+// enough to decode here.
+//
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <jpeglib.h>
+#include <png.h>
+#include "Texture.h"
+
+namespace
+{
+
+bool readPngFile(const char *filename, Image &outImage)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, filename))
+    {
+        fprintf(stderr, "%s: %s\n", filename, image.message);
+        return false;
+    }
+
+    image.format = PNG_FORMAT_RGBA;
+    outImage.width = int(image.width);
+    outImage.height = int(image.height);
+    outImage.pixels.resize(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, nullptr, outImage.pixels.data(), 0, nullptr))
+    {
+        fprintf(stderr, "%s: %s\n", filename, image.message);
+        png_image_free(&image);
+        return false;
+    }
+
+    return true;
+}
+
+// libjpeg's default error handler exits the program. Return to
+// readJpegFile instead.
+struct JpegErrorManager
+{
+    jpeg_error_mgr base;
+    jmp_buf returnPoint;
+};
+
+void jpegErrorExit(j_common_ptr info)
+{
+    char message[JMSG_LENGTH_MAX];
+    info->err->format_message(info, message);
+    fprintf(stderr, "%s\n", message);
+    longjmp(reinterpret_cast<JpegErrorManager*>(info->err)->returnPoint, 1);
+}
+
+bool readJpegFile(FILE *file, Image &outImage)
+{
+    jpeg_decompress_struct info;
+    JpegErrorManager error;
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit = jpegErrorExit;
+    if (setjmp(error.returnPoint))
+    {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_stdio_src(&info, file);
+    jpeg_read_header(&info, TRUE);
+    info.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&info);
+    const int width = int(info.output_width);
+    const int height = int(info.output_height);
+    outImage.width = width;
+    outImage.height = height;
+    outImage.pixels.resize(size_t(width * height * 4));
+    while (info.output_scanline < info.output_height)
+    {
+        // Read RGB pixels into the start of the row, then expand them to
+        // RGBA, starting at the end so nothing is overwritten before it is
+        // moved. Nothing here needs to be destroyed if there is an error.
+        uint8_t *row = &outImage.pixels[size_t(info.output_scanline) * size_t(width) * 4];
+        jpeg_read_scanlines(&info, &row, 1);
+        for (int x = width - 1; x >= 0; x--)
+        {
+            row[x * 4 + 3] = 0xff;
+            row[x * 4 + 2] = row[x * 3 + 2];
+            row[x * 4 + 1] = row[x * 3 + 1];
+            row[x * 4] = row[x * 3];
+        }
+    }
+
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+// Uncompressed and run length encoded true color and grayscale images.
+bool readTgaFile(FILE *file, Image &outImage)
+{
+    uint8_t header[18];
+    if (fread(header, sizeof(header), 1, file) != 1)
+        return false;
+
+    const int idLength = header[0];
+    const int colorMapType = header[1];
+    const int imageType = header[2];
+    const int width = header[12] | (header[13] << 8);
+    const int height = header[14] | (header[15] << 8);
+    const int bitsPerPixel = header[16];
+    const bool topToBottom = (header[17] & 0x20) != 0;
+    const bool rle = imageType == 10 || imageType == 11;
+    const bool grayscale = imageType == 3 || imageType == 11;
+    const int bytesPerPixel = bitsPerPixel / 8;
+    if (colorMapType != 0 || (imageType != 2 && imageType != 3 && !rle)
+            || (grayscale ? bitsPerPixel != 8 : bitsPerPixel != 24 && bitsPerPixel != 32))
+    {
+        fprintf(stderr, "unsupported TGA type\n");
+        return false;
+    }
+
+    fseek(file, idLength, SEEK_CUR);
+    outImage.width = width;
+    outImage.height = height;
+    outImage.pixels.resize(size_t(width * height * 4));
+    int packetCount = 0;
+    bool repeatPacket = false;
+    uint8_t value[4] = { 0, 0, 0, 0xff };
+    for (int i = 0; i < width * height; i++)
+    {
+        if (!rle || packetCount == 0 || !repeatPacket)
+        {
+            if (rle && packetCount == 0)
+            {
+                const int packetHeader = fgetc(file);
+                if (packetHeader == EOF)
+                    return false;
+
+                repeatPacket = (packetHeader & 0x80) != 0;
+                packetCount = (packetHeader & 0x7f) + 1;
+            }
+
+            // Pixels are stored BGR(A)
+            uint8_t bytes[4];
+            if (fread(bytes, size_t(bytesPerPixel), 1, file) != 1)
+                return false;
+
+            if (grayscale)
+                value[0] = value[1] = value[2] = bytes[0];
+            else
+            {
+                value[0] = bytes[2];
+                value[1] = bytes[1];
+                value[2] = bytes[0];
+                value[3] = bytesPerPixel == 4 ? bytes[3] : 0xff;
+            }
+        }
+
+        packetCount--;
+        const int x = i % width;
+        const int y = topToBottom ? i / width : height - 1 - i / width;
+        memcpy(&outImage.pixels[size_t(y * width + x) * 4], value, 4);
+    }
+
+    return true;
+}
+
+} // namespace
+
+bool readImageFile(const char *filename, Image &outImage)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == nullptr)
+    {
+        perror(filename);
+        return false;
+    }
+
+    uint8_t signature[8] = { 0 };
+    const bool isPng = fread(signature, 1, sizeof(signature), file) == sizeof(signature)
+                       && png_sig_cmp(signature, 0, sizeof(signature)) == 0;
+    const bool isJpeg = signature[0] == 0xff && signature[1] == 0xd8;
+    rewind(file);
+    bool success;
+    if (isPng)
+    {
+        fclose(file);
+        return readPngFile(filename, outImage);
+    }
+    else if (isJpeg)
+        success = readJpegFile(file, outImage);
+    else
+    {
+        success = readTgaFile(file, outImage);
+        if (!success)
+            fprintf(stderr, "%s: error reading image\n", filename);
+    }
+
+    fclose(file);
+    return success;
+}
@@ -0,0 +1,63 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Position (3), texture coordinate (2), normal (3). This is the order
+// scene_viewer passes attributes to its shaders.
+const int kAttrsPerVertex = 8;
+
+struct Vertex
+{
+    float attrs[kAttrsPerVertex];
+};
+
+// Triangles that use the same texture.
+struct Mesh
+{
+    int textureId;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+};
+
+struct Scene
+{
+    std::vector<std::string> textureFiles;
+    std::vector<Mesh> meshes;
+};
+
+// Read a Wavefront .OBJ file and the material files it references.
+// Vertices with the same attributes are shared, polygons are split into
+// triangles, and a new mesh starts each time the texture changes. Returns
+// false if the file couldn't be read.
+bool readObjFile(const char *filename, Scene &scene);
+
+// Split a mesh into clusters of up to maxTriangles triangles. Each split
+// divides the triangles at the median of their centers along the longest
+// axis, so clusters are spatially compact and have small bounding boxes,
+// and neighboring clusters are adjacent in the output.
+void splitMesh(const Mesh &mesh, int maxTriangles, std::vector<Mesh> &outClusters);
+
+// Reorder triangles so ones that share vertices are close together in the
+// index buffer (Tom Forsyth, "Linear-Speed Vertex Cache Optimisation").
+void optimizeTriangleOrder(Mesh &mesh);
+
+// Renumber vertices in the order the index buffer first uses them.
+void optimizeVertexOrder(Mesh &mesh);
@@ -0,0 +1,301 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//
+// librender shades every vertex in a mesh before it sets up triangles, so
+// there is no post-transform vertex cache to optimize for. However, triangle
+// setup gathers the parameters of 16 consecutive triangles at once, and
+// tiles are binned in submission order. When triangles that share vertices
+// and screen area are next to each other in the index buffer, those gathers
+// hit the same cache lines and each tile's triangle list covers a compact
+// area. The same orderings that optimize for a vertex cache do this.
+//
+
+#include <math.h>
+#include <algorithm>
+#include "Mesh.h"
+
+namespace
+{
+
+const int kCacheSize = 32;
+const float kCacheDecayPower = 1.5f;
+const float kLastTriangleScore = 0.75f;
+const float kValenceBoostScale = 2.0f;
+const float kValenceBoostPower = 0.5f;
+
+struct VertexState
+{
+    int cachePosition = -1;
+    int remainingTriangles = 0;
+    float score = 0.0f;
+    std::vector<int> triangles;
+};
+
+float vertexScore(const VertexState &vertex)
+{
+    if (vertex.remainingTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (vertex.cachePosition >= 0)
+    {
+        if (vertex.cachePosition < 3)
+        {
+            // This vertex was used in the last triangle. Give it a fixed
+            // score, so it doesn't matter which of the three it was.
+            score = kLastTriangleScore;
+        }
+        else
+        {
+            const float scaler = 1.0f / (kCacheSize - 3);
+            score = powf(1.0f - float(vertex.cachePosition - 3) * scaler, kCacheDecayPower);
+        }
+    }
+
+    // Boost vertices with few remaining triangles, so isolated triangles
+    // don't get left behind.
+    score += kValenceBoostScale * powf(float(vertex.remainingTriangles), -kValenceBoostPower);
+    return score;
+}
+
+// Find the bounding box of the centers of the triangles
+void computeCenterBounds(const std::vector<int> &triangles, const std::vector<float> &centers,
+                         float *outCenterMin, float *outCenterMax)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        outCenterMin[axis] = INFINITY;
+        outCenterMax[axis] = -INFINITY;
+    }
+
+    for (int triangle : triangles)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const float center = centers[size_t(triangle) * 3 + size_t(axis)];
+            outCenterMin[axis] = std::min(outCenterMin[axis], center);
+            outCenterMax[axis] = std::max(outCenterMax[axis], center);
+        }
+    }
+}
+
+// Copy the triangles to a new mesh, which only contains the vertices they
+// use.
+void extractCluster(const Mesh &mesh, const std::vector<int> &triangles,
+                    std::vector<Mesh> &outClusters)
+{
+    std::vector<int> remap(mesh.vertices.size(), -1);
+    outClusters.push_back(Mesh());
+    Mesh &cluster = outClusters.back();
+    cluster.textureId = mesh.textureId;
+    for (int triangle : triangles)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            const uint32_t index = mesh.indices[size_t(triangle) * 3 + size_t(i)];
+            if (remap[index] < 0)
+            {
+                remap[index] = int(cluster.vertices.size());
+                cluster.vertices.push_back(mesh.vertices[index]);
+            }
+
+            cluster.indices.push_back(uint32_t(remap[index]));
+        }
+    }
+}
+
+void splitRecursive(const Mesh &mesh, std::vector<int> &triangles,
+                    const std::vector<float> &centers, int maxTriangles,
+                    std::vector<Mesh> &outClusters)
+{
+    if (int(triangles.size()) <= maxTriangles)
+    {
+        extractCluster(mesh, triangles, outClusters);
+        return;
+    }
+
+    float centerMin[3];
+    float centerMax[3];
+    computeCenterBounds(triangles, centers, centerMin, centerMax);
+    int splitAxis = 0;
+    for (int axis = 1; axis < 3; axis++)
+    {
+        if (centerMax[axis] - centerMin[axis] > centerMax[splitAxis] - centerMin[splitAxis])
+            splitAxis = axis;
+    }
+
+    auto middle = triangles.begin() + triangles.size() / 2;
+    std::nth_element(triangles.begin(), middle, triangles.end(),
+                     [&centers, splitAxis](int a, int b)
+    {
+        return centers[size_t(a) * 3 + size_t(splitAxis)]
+               < centers[size_t(b) * 3 + size_t(splitAxis)];
+    });
+
+    std::vector<int> upper(middle, triangles.end());
+    triangles.erase(middle, triangles.end());
+    splitRecursive(mesh, triangles, centers, maxTriangles, outClusters);
+    splitRecursive(mesh, upper, centers, maxTriangles, outClusters);
+}
+
+} // namespace
+
+void splitMesh(const Mesh &mesh, int maxTriangles, std::vector<Mesh> &outClusters)
+{
+    const size_t numTriangles = mesh.indices.size() / 3;
+    std::vector<float> centers(numTriangles * 3);
+    std::vector<int> triangles(numTriangles);
+    for (size_t triangle = 0; triangle < numTriangles; triangle++)
+    {
+        triangles[triangle] = int(triangle);
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float sum = 0.0f;
+            for (int i = 0; i < 3; i++)
+                sum += mesh.vertices[mesh.indices[triangle * 3 + size_t(i)]].attrs[axis];
+
+            centers[triangle * 3 + size_t(axis)] = sum / 3.0f;
+        }
+    }
+
+    splitRecursive(mesh, triangles, centers, maxTriangles, outClusters);
+}
+
+void optimizeTriangleOrder(Mesh &mesh)
+{
+    const int numTriangles = int(mesh.indices.size() / 3);
+    std::vector<VertexState> vertices(mesh.vertices.size());
+    for (int triangle = 0; triangle < numTriangles; triangle++)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            VertexState &vertex = vertices[mesh.indices[size_t(triangle * 3 + i)]];
+            vertex.remainingTriangles++;
+            vertex.triangles.push_back(triangle);
+        }
+    }
+
+    for (VertexState &vertex : vertices)
+        vertex.score = vertexScore(vertex);
+
+    std::vector<float> triangleScores(size_t(numTriangles), 0.0f);
+    std::vector<bool> added(size_t(numTriangles), false);
+    for (int triangle = 0; triangle < numTriangles; triangle++)
+    {
+        for (int i = 0; i < 3; i++)
+            triangleScores[size_t(triangle)] += vertices[mesh.indices[size_t(triangle * 3 + i)]].score;
+    }
+
+    std::vector<uint32_t> newIndices;
+    newIndices.reserve(mesh.indices.size());
+    std::vector<uint32_t> cache;
+    int bestTriangle = -1;
+    int scanStart = 0;
+    for (int count = 0; count < numTriangles; count++)
+    {
+        if (bestTriangle < 0)
+        {
+            // Nothing in the cache is connected to a remaining triangle.
+            // Start over from the highest scoring triangle left.
+            float bestScore = -1.0f;
+            while (added[size_t(scanStart)])
+                scanStart++;
+
+            for (int triangle = scanStart; triangle < numTriangles; triangle++)
+            {
+                if (!added[size_t(triangle)] && triangleScores[size_t(triangle)] > bestScore)
+                {
+                    bestScore = triangleScores[size_t(triangle)];
+                    bestTriangle = triangle;
+                }
+            }
+        }
+
+        added[size_t(bestTriangle)] = true;
+        std::vector<uint32_t> newCache;
+        for (int i = 0; i < 3; i++)
+        {
+            const uint32_t index = mesh.indices[size_t(bestTriangle * 3 + i)];
+            newIndices.push_back(index);
+            newCache.push_back(index);
+
+            VertexState &vertex = vertices[index];
+            vertex.remainingTriangles--;
+            vertex.triangles.erase(std::find(vertex.triangles.begin(), vertex.triangles.end(),
+                                             bestTriangle));
+        }
+
+        // Move this triangle's vertices to the front of the LRU cache.
+        for (uint32_t index : cache)
+        {
+            if (std::find(newCache.begin(), newCache.end(), index) == newCache.end())
+                newCache.push_back(index);
+        }
+
+        // Update the scores of all vertices that were in the cache before
+        // or are now, and the triangles that use them. The best triangle for
+        // the next step is one of these.
+        for (size_t i = 0; i < newCache.size(); i++)
+        {
+            VertexState &vertex = vertices[newCache[i]];
+            vertex.cachePosition = i < size_t(kCacheSize) ? int(i) : -1;
+            const float oldScore = vertex.score;
+            vertex.score = vertexScore(vertex);
+            for (int triangle : vertex.triangles)
+                triangleScores[size_t(triangle)] += vertex.score - oldScore;
+        }
+
+        if (newCache.size() > size_t(kCacheSize))
+            newCache.resize(size_t(kCacheSize));
+
+        cache.swap(newCache);
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (uint32_t index : cache)
+        {
+            for (int triangle : vertices[index].triangles)
+            {
+                if (triangleScores[size_t(triangle)] > bestScore)
+                {
+                    bestScore = triangleScores[size_t(triangle)];
+                    bestTriangle = triangle;
+                }
+            }
+        }
+    }
+
+    mesh.indices.swap(newIndices);
+}
+
+void optimizeVertexOrder(Mesh &mesh)
+{
+    std::vector<int> remap(mesh.vertices.size(), -1);
+    std::vector<Vertex> newVertices;
+    newVertices.reserve(mesh.vertices.size());
+    for (uint32_t &index : mesh.indices)
+    {
+        if (remap[index] < 0)
+        {
+            remap[index] = int(newVertices.size());
+            newVertices.push_back(mesh.vertices[index]);
+        }
+
+        index = uint32_t(remap[index]);
+    }
+
+    mesh.vertices.swap(newVertices);
+}
@@ -0,0 +1,364 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <unordered_map>
+#include "Mesh.h"
+
+namespace
+{
+
+struct VertexHash
+{
+    size_t operator()(const Vertex &vertex) const
+    {
+        // FNV-1a
+        const unsigned char *bytes = reinterpret_cast<const unsigned char*>(vertex.attrs);
+        size_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(vertex.attrs); i++)
+            hash = (hash ^ bytes[i]) * 16777619u;
+
+        return hash;
+    }
+};
+
+struct VertexEqual
+{
+    bool operator()(const Vertex &a, const Vertex &b) const
+    {
+        return memcmp(a.attrs, b.attrs, sizeof(a.attrs)) == 0;
+    }
+};
+
+struct ObjParser
+{
+    // Values are parsed as doubles, which computeFaceNormal uses
+    std::vector<double> positions;
+    std::vector<double> textureCoordinates;
+    std::vector<double> normals;
+    std::map<std::string, int> materialToTexture;
+    std::map<std::string, int> fileToTexture;
+    std::unordered_map<Vertex, uint32_t, VertexHash, VertexEqual> vertexToIndex;
+    Mesh currentMesh;
+};
+
+std::string directoryOf(const char *filename)
+{
+    const char *slash = strrchr(filename, '/');
+    if (slash == nullptr)
+        return ".";
+
+    return std::string(filename, size_t(slash - filename));
+}
+
+// Split a line into whitespace separated fields. This modifies the line.
+int splitFields(char *line, char **fields, int maxFields)
+{
+    int numFields = 0;
+    char *token = strtok(line, " \t\r\n");
+    while (token != nullptr && numFields < maxFields)
+    {
+        fields[numFields++] = token;
+        token = strtok(nullptr, " \t\r\n");
+    }
+
+    return numFields;
+}
+
+// Convert an OBJ index, which is one based, or relative to the end of the
+// list if it is negative, to a zero based index. Returns -1 if it is out
+// of range.
+int convertIndex(const char *str, size_t listSize)
+{
+    long index = strtol(str, nullptr, 10);
+    if (index < 0)
+        index += long(listSize);
+    else
+        index--;
+
+    if (index < 0 || index >= long(listSize))
+        return -1;
+
+    return int(index);
+}
+
+bool readMtlFile(const char *filename, ObjParser &parser, Scene &scene)
+{
+    printf("read material file %s\n", filename);
+    FILE *file = fopen(filename, "r");
+    if (file == nullptr)
+    {
+        perror("can't open material file");
+        return false;
+    }
+
+    std::string currentName;
+    char line[1024];
+    char *fields[16];
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] == '#')
+            continue;
+
+        int numFields = splitFields(line, fields, 16);
+        if (numFields < 2)
+            continue;
+
+        if (strcmp(fields[0], "newmtl") == 0)
+        {
+            currentName = fields[1];
+            parser.materialToTexture[currentName] = -1;
+        }
+        else if (strcmp(fields[0], "map_Kd") == 0)
+        {
+            std::string textureFile = fields[1];
+            auto it = parser.fileToTexture.find(textureFile);
+            if (it != parser.fileToTexture.end())
+            {
+                // This texture is already used by another material
+                parser.materialToTexture[currentName] = it->second;
+            }
+            else
+            {
+                int textureId = int(scene.textureFiles.size());
+                parser.materialToTexture[currentName] = textureId;
+                parser.fileToTexture[textureFile] = textureId;
+                for (char &c : textureFile)
+                {
+                    if (c == '\\')
+                        c = '/';
+                }
+
+                scene.textureFiles.push_back(directoryOf(filename) + "/" + textureFile);
+            }
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+void computeFaceNormal(const double *v1, const double *v2, const double *v3, float *outNormal)
+{
+    const double ax = v2[0] - v1[0];
+    const double ay = v2[1] - v1[1];
+    const double az = v2[2] - v1[2];
+    const double bx = v3[0] - v1[0];
+    const double by = v3[1] - v1[1];
+    const double bz = v3[2] - v1[2];
+    const double cx = ay * bz - az * by;
+    const double cy = az * bx - ax * bz;
+    const double cz = ax * by - ay * bx;
+    const double mag = sqrt(cx * cx + cy * cy + cz * cz);
+    if (mag == 0.0)
+    {
+        outNormal[0] = outNormal[1] = outNormal[2] = 0.0f;
+        return;
+    }
+
+    outNormal[0] = float(cx / mag);
+    outNormal[1] = float(cy / mag);
+    outNormal[2] = float(cz / mag);
+}
+
+bool parseFace(char **fields, int numFields, ObjParser &parser)
+{
+    const int kMaxPolygonVertices = 64;
+    if (numFields < 3 || numFields > kMaxPolygonVertices)
+        return false;
+
+    // The OBJ file indexes positions, texture coordinates, and normals
+    // independently. Combine them into a single vertex.
+    int positionIndex[kMaxPolygonVertices];
+    int textureIndex[kMaxPolygonVertices];
+    int normalIndex[kMaxPolygonVertices];
+    bool hasNormals = true;
+    for (int i = 0; i < numFields; i++)
+    {
+        positionIndex[i] = convertIndex(fields[i], parser.positions.size() / 3);
+        if (positionIndex[i] < 0)
+            return false;
+
+        textureIndex[i] = -1;
+        normalIndex[i] = -1;
+        char *slash = strchr(fields[i], '/');
+        if (slash != nullptr)
+        {
+            if (slash[1] != '/' && slash[1] != '\0')
+            {
+                textureIndex[i] = convertIndex(slash + 1, parser.textureCoordinates.size() / 2);
+                if (textureIndex[i] < 0)
+                    return false;
+            }
+
+            slash = strchr(slash + 1, '/');
+            if (slash != nullptr)
+            {
+                normalIndex[i] = convertIndex(slash + 1, parser.normals.size() / 3);
+                if (normalIndex[i] < 0)
+                    return false;
+            }
+        }
+
+        if (normalIndex[i] < 0)
+            hasNormals = false;
+    }
+
+    // If the face does not have normals, use the face normal for all
+    // vertices. This isn't perfect because the vertex normal should be the
+    // combination of all face normals, but it's good enough for our
+    // purposes.
+    float faceNormal[3];
+    if (!hasNormals)
+    {
+        computeFaceNormal(&parser.positions[size_t(positionIndex[0]) * 3],
+                          &parser.positions[size_t(positionIndex[1]) * 3],
+                          &parser.positions[size_t(positionIndex[2]) * 3], faceNormal);
+    }
+
+    uint32_t polygonIndices[kMaxPolygonVertices];
+    Mesh &mesh = parser.currentMesh;
+    for (int i = 0; i < numFields; i++)
+    {
+        Vertex vertex;
+        for (int axis = 0; axis < 3; axis++)
+            vertex.attrs[axis] = float(parser.positions[size_t(positionIndex[i] * 3 + axis)]);
+
+        for (int axis = 0; axis < 2; axis++)
+        {
+            vertex.attrs[3 + axis] = textureIndex[i] < 0 ? 0.0f
+                                     : float(parser.textureCoordinates[size_t(textureIndex[i] * 2
+                                             + axis)]);
+        }
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            vertex.attrs[5 + axis] = hasNormals ? float(parser.normals[size_t(normalIndex[i] * 3
+                                     + axis)]) : faceNormal[axis];
+        }
+
+        auto it = parser.vertexToIndex.find(vertex);
+        if (it != parser.vertexToIndex.end())
+            polygonIndices[i] = it->second;
+        else
+        {
+            polygonIndices[i] = uint32_t(mesh.vertices.size());
+            parser.vertexToIndex[vertex] = polygonIndices[i];
+            mesh.vertices.push_back(vertex);
+        }
+    }
+
+    // Convert the polygon to a triangle fan
+    for (int i = 1; i < numFields - 1; i++)
+    {
+        mesh.indices.push_back(polygonIndices[0]);
+        mesh.indices.push_back(polygonIndices[i]);
+        mesh.indices.push_back(polygonIndices[i + 1]);
+    }
+
+    return true;
+}
+
+void finishMesh(ObjParser &parser, Scene &scene)
+{
+    if (!parser.currentMesh.indices.empty())
+    {
+        scene.meshes.push_back(parser.currentMesh);
+        parser.currentMesh.vertices.clear();
+        parser.currentMesh.indices.clear();
+        parser.vertexToIndex.clear();
+    }
+}
+
+} // namespace
+
+bool readObjFile(const char *filename, Scene &scene)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == nullptr)
+    {
+        perror("can't open OBJ file");
+        return false;
+    }
+
+    ObjParser parser;
+    parser.currentMesh.textureId = -1;
+    char line[1024];
+    char *fields[68];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        lineNumber++;
+        if (line[0] == '#')
+            continue;
+
+        int numFields = splitFields(line, fields, 68);
+        if (numFields == 0)
+            continue;
+
+        if (strcmp(fields[0], "v") == 0 && numFields >= 4)
+        {
+            for (int i = 1; i < 4; i++)
+                parser.positions.push_back(strtod(fields[i], nullptr));
+        }
+        else if (strcmp(fields[0], "vt") == 0 && numFields >= 3)
+        {
+            for (int i = 1; i < 3; i++)
+                parser.textureCoordinates.push_back(strtod(fields[i], nullptr));
+        }
+        else if (strcmp(fields[0], "vn") == 0 && numFields >= 4)
+        {
+            for (int i = 1; i < 4; i++)
+                parser.normals.push_back(strtod(fields[i], nullptr));
+        }
+        else if (strcmp(fields[0], "f") == 0)
+        {
+            if (!parseFace(fields + 1, numFields - 1, parser))
+            {
+                fprintf(stderr, "%s:%d: bad face\n", filename, lineNumber);
+                fclose(file);
+                return false;
+            }
+        }
+        else if (strcmp(fields[0], "usemtl") == 0 && numFields >= 2)
+        {
+            auto it = parser.materialToTexture.find(fields[1]);
+            int textureId = it != parser.materialToTexture.end() ? it->second : -1;
+            if (textureId != parser.currentMesh.textureId)
+            {
+                finishMesh(parser, scene);
+                parser.currentMesh.textureId = textureId;
+            }
+        }
+        else if (strcmp(fields[0], "mtllib") == 0 && numFields >= 2)
+        {
+            std::string mtlFile = directoryOf(filename) + "/" + fields[1];
+            if (!readMtlFile(mtlFile.c_str(), parser, scene))
+            {
+                fclose(file);
+                return false;
+            }
+        }
+    }
+
+    finishMesh(parser, scene);
+    fclose(file);
+    return true;
+}
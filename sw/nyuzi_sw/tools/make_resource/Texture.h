@@ -0,0 +1,71 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Must match SurfaceFormat in librender/Surface.h
+const int kFormatRGBA8888 = 0;
+const int kFormatBC1 = 1;
+const int kFormatBC3 = 2;
+const int kFormatRGBA8888Tiled = 3;
+
+// Number of mip levels, including the full size image. Textures that are
+// too small have fewer.
+const int kNumMipLevels = 4;
+
+// 32 bits per pixel, red in the low byte, alpha in the high byte.
+struct Image
+{
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+struct TextureOptions
+{
+    // Use BC1 or BC3 if all mip levels are a multiple of four texels wide
+    // and high.
+    bool compress = false;
+
+    // Otherwise use RGBA8888Tiled if all mip levels are a multiple of four.
+    bool tiled = false;
+
+    // If this is not empty, converted textures are stored in this directory
+    // and reused if the image file and options haven't changed.
+    std::string cacheDir;
+};
+
+// All mip levels of a texture, in the format that scene_viewer loads.
+struct TextureData
+{
+    int width = 0;
+    int height = 0;
+    int format = kFormatRGBA8888;
+    int mipLevels = 0;
+    std::vector<uint8_t> data;
+};
+
+// Decode a PNG, JPEG, or TGA file. Prints an error and returns false if
+// the file can't be read.
+bool readImageFile(const char *filename, Image &outImage);
+
+// Read an image file and convert it to a texture. This is thread safe.
+bool convertTexture(const std::string &filename, const TextureOptions &options,
+                    TextureData &outTexture);
@@ -0,0 +1,426 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "Texture.h"
+
+namespace
+{
+
+// Change this if the output for the same inputs changes, so old cache
+// entries aren't used.
+const uint32_t kCacheVersion = 1;
+const uint32_t kCacheMagic = 0x5845544e;	// 'NTEX'
+
+struct CacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t mipLevels;
+    uint32_t dataSize;
+};
+
+// Downsample RGBA values along one axis with a box filter. Each
+// destination texel is the average of the source texels it covers, weighted
+// by the covered area, which also works for sizes that aren't a power of
+// two. stride is the distance between texels along the axis, and
+// sourceLineStride and destLineStride between the lines that are resized.
+void resizeAxis(const float *source, int sourceSize, int sourceLineStride, float *dest,
+                int destSize, int destLineStride, int stride, int numLines)
+{
+    const float scale = float(sourceSize) / float(destSize);
+    for (int line = 0; line < numLines; line++)
+    {
+        const float *sourceLine = source + line * sourceLineStride;
+        float *destLine = dest + line * destLineStride;
+        for (int destIndex = 0; destIndex < destSize; destIndex++)
+        {
+            const float start = float(destIndex) * scale;
+            const float end = start + scale;
+            float sum[4] = { 0, 0, 0, 0 };
+            for (int sourceIndex = int(start); sourceIndex < sourceSize
+                    && float(sourceIndex) < end; sourceIndex++)
+            {
+                const float weight = std::min(end, float(sourceIndex + 1))
+                                     - std::max(start, float(sourceIndex));
+                for (int channel = 0; channel < 4; channel++)
+                    sum[channel] += sourceLine[sourceIndex * stride + channel] * weight;
+            }
+
+            for (int channel = 0; channel < 4; channel++)
+                destLine[destIndex * stride + channel] = sum[channel] / scale;
+        }
+    }
+}
+
+Image downsample(const Image &source, int width, int height)
+{
+    const int sourceWidth = source.width;
+    const int sourceHeight = source.height;
+    std::vector<float> sourceValues(source.pixels.begin(), source.pixels.end());
+    std::vector<float> horizontal(size_t(width * sourceHeight * 4));
+    std::vector<float> values(size_t(width * height * 4));
+    resizeAxis(sourceValues.data(), sourceWidth, sourceWidth * 4, horizontal.data(), width,
+               width * 4, 4, sourceHeight);
+    resizeAxis(horizontal.data(), sourceHeight, 4, values.data(), height, 4, width * 4, width);
+
+    Image dest;
+    dest.width = width;
+    dest.height = height;
+    dest.pixels.resize(values.size());
+    for (size_t i = 0; i < values.size(); i++)
+        dest.pixels[i] = uint8_t(std::min(255.0f, values[i] + 0.5f));
+
+    return dest;
+}
+
+uint16_t pack565(const uint8_t *color)
+{
+    return uint16_t(((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3));
+}
+
+void unpack565(uint16_t value, int *outColor)
+{
+    const int red = (value >> 11) & 0x1f;
+    const int green = (value >> 5) & 0x3f;
+    const int blue = value & 0x1f;
+    outColor[0] = (red << 3) | (red >> 2);
+    outColor[1] = (green << 2) | (green >> 4);
+    outColor[2] = (blue << 3) | (blue >> 2);
+}
+
+template <typename T>
+void append(std::vector<uint8_t> &data, T value)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+// Encode the RGB channels of 16 texels as a BC1 color block. The endpoints
+// are the corners of the bounding box of the colors. Always uses four
+// color mode (color0 > color1), which is required for the color half of
+// BC3.
+void encodeColorBlock(const uint8_t texels[16][4], std::vector<uint8_t> &outData)
+{
+    uint8_t low[3] = { 255, 255, 255 };
+    uint8_t high[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+    {
+        for (int channel = 0; channel < 3; channel++)
+        {
+            low[channel] = std::min(low[channel], texels[i][channel]);
+            high[channel] = std::max(high[channel], texels[i][channel]);
+        }
+    }
+
+    uint16_t color0 = pack565(high);
+    uint16_t color1 = pack565(low);
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    append(outData, color0);
+    append(outData, color1);
+    if (color0 == color1)
+    {
+        // Solid block: all indices select color0
+        append(outData, uint32_t(0));
+        return;
+    }
+
+    int palette[4][3];
+    unpack565(color0, palette[0]);
+    unpack565(color1, palette[1]);
+    for (int channel = 0; channel < 3; channel++)
+    {
+        palette[2][channel] = (2 * palette[0][channel] + palette[1][channel]) / 3;
+        palette[3][channel] = (palette[0][channel] + 2 * palette[1][channel]) / 3;
+    }
+
+    uint32_t indices = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int bestIndex = 0;
+        int bestError = 0x7fffffff;
+        for (int index = 0; index < 4; index++)
+        {
+            int error = 0;
+            for (int channel = 0; channel < 3; channel++)
+            {
+                const int diff = palette[index][channel] - texels[i][channel];
+                error += diff * diff;
+            }
+
+            if (error < bestError)
+            {
+                bestIndex = index;
+                bestError = error;
+            }
+        }
+
+        indices |= uint32_t(bestIndex) << (i * 2);
+    }
+
+    append(outData, indices);
+}
+
+// Encode the alpha channel of 16 texels as a BC3 alpha block.
+void encodeAlphaBlock(const uint8_t texels[16][4], std::vector<uint8_t> &outData)
+{
+    uint8_t alpha0 = 0;
+    uint8_t alpha1 = 255;
+    for (int i = 0; i < 16; i++)
+    {
+        alpha0 = std::max(alpha0, texels[i][3]);
+        alpha1 = std::min(alpha1, texels[i][3]);
+    }
+
+    outData.push_back(alpha0);
+    outData.push_back(alpha1);
+    uint64_t indices = 0;
+    if (alpha0 != alpha1)
+    {
+        // Eight alpha mode (alpha0 > alpha1)
+        int palette[8] = { alpha0, alpha1 };
+        for (int step = 1; step < 7; step++)
+            palette[step + 1] = ((7 - step) * alpha0 + step * alpha1) / 7;
+
+        for (int i = 0; i < 16; i++)
+        {
+            int bestIndex = 0;
+            int bestError = 0x7fffffff;
+            for (int index = 0; index < 8; index++)
+            {
+                const int error = std::abs(palette[index] - texels[i][3]);
+                if (error < bestError)
+                {
+                    bestIndex = index;
+                    bestError = error;
+                }
+            }
+
+            indices |= uint64_t(bestIndex) << (i * 3);
+        }
+    }
+
+    for (int i = 0; i < 6; i++)
+        outData.push_back(uint8_t(indices >> (i * 8)));
+}
+
+// Store 4x4 blocks in row major order. Each is encoded in a block
+// compressed format, or stored as 16 texels for RGBA8888Tiled.
+void appendBlocks(const Image &image, int format, std::vector<uint8_t> &outData)
+{
+    for (int blockY = 0; blockY < image.height; blockY += 4)
+    {
+        for (int blockX = 0; blockX < image.width; blockX += 4)
+        {
+            uint8_t texels[16][4];
+            for (int y = 0; y < 4; y++)
+            {
+                memcpy(texels[y * 4], &image.pixels[size_t((blockY + y) * image.width + blockX) * 4],
+                       16);
+            }
+
+            if (format == kFormatRGBA8888Tiled)
+                outData.insert(outData.end(), texels[0], texels[0] + 64);
+            else
+            {
+                if (format == kFormatBC3)
+                    encodeAlphaBlock(texels, outData);
+
+                encodeColorBlock(texels, outData);
+            }
+        }
+    }
+}
+
+uint64_t hashBytes(uint64_t hash, const void *data, size_t length)
+{
+    // FNV-1a
+    const uint8_t *bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+
+    return hash;
+}
+
+// Hash the file contents and the options that affect the output.
+bool computeCacheKey(const std::string &filename, const TextureOptions &options,
+                     std::string &outKey)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+    {
+        perror(filename.c_str());
+        return false;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const uint32_t settings[] = { kCacheVersion, uint32_t(kNumMipLevels), options.compress,
+                                  options.tiled };
+    hash = hashBytes(hash, settings, sizeof(settings));
+    uint8_t buffer[0x10000];
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        hash = hashBytes(hash, buffer, got);
+
+    fclose(file);
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    outKey = key;
+    return true;
+}
+
+bool readCacheFile(const std::string &path, TextureData &outTexture)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    CacheHeader header;
+    bool success = fread(&header, sizeof(header), 1, file) == 1 && header.magic == kCacheMagic
+                   && header.version == kCacheVersion;
+    if (success)
+    {
+        outTexture.width = int(header.width);
+        outTexture.height = int(header.height);
+        outTexture.format = int(header.format);
+        outTexture.mipLevels = int(header.mipLevels);
+        outTexture.data.resize(header.dataSize);
+        success = fread(outTexture.data.data(), 1, header.dataSize, file) == header.dataSize;
+    }
+
+    fclose(file);
+    return success;
+}
+
+// Write to a temporary file and rename it, so other threads or processes
+// never see a partially written file.
+void writeCacheFile(const std::string &path, const TextureData &texture)
+{
+    std::string tempPath = path + ".XXXXXX";
+    const int fd = mkstemp(&tempPath[0]);
+    FILE *file = fd < 0 ? nullptr : fdopen(fd, "wb");
+    if (file == nullptr)
+    {
+        perror(tempPath.c_str());
+        return;
+    }
+
+    const CacheHeader header = { kCacheMagic, kCacheVersion, uint32_t(texture.width),
+                                 uint32_t(texture.height), uint32_t(texture.format),
+                                 uint32_t(texture.mipLevels), uint32_t(texture.data.size())
+                               };
+    const bool success = fwrite(&header, sizeof(header), 1, file) == 1
+                         && fwrite(texture.data.data(), 1, texture.data.size(), file)
+                         == texture.data.size();
+    fclose(file);
+    if (!success || rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        perror(path.c_str());
+        remove(tempPath.c_str());
+    }
+}
+
+bool buildTexture(const std::string &filename, const TextureOptions &options,
+                  TextureData &outTexture)
+{
+    std::vector<Image> levels(1);
+    if (!readImageFile(filename.c_str(), levels[0]))
+        return false;
+
+    const int width = levels[0].width;
+    const int height = levels[0].height;
+    for (int level = 1; level < kNumMipLevels && (width >> level) > 0
+            && (height >> level) > 0; level++)
+        levels.push_back(downsample(levels[0], width >> level, height >> level));
+
+    // Block formats need every mip level to be a whole number of blocks.
+    // Textures that need alpha use BC3, others BC1.
+    bool wholeBlocks = true;
+    for (const Image &image : levels)
+    {
+        if ((image.width % 4) != 0 || (image.height % 4) != 0)
+            wholeBlocks = false;
+    }
+
+    int format = kFormatRGBA8888;
+    if (options.compress && wholeBlocks)
+    {
+        format = kFormatBC1;
+        for (size_t i = 3; i < levels[0].pixels.size(); i += 4)
+        {
+            if (levels[0].pixels[i] != 255)
+            {
+                format = kFormatBC3;
+                break;
+            }
+        }
+    }
+    else if (options.tiled && wholeBlocks)
+        format = kFormatRGBA8888Tiled;
+
+    outTexture.width = width;
+    outTexture.height = height;
+    outTexture.format = format;
+    outTexture.mipLevels = int(levels.size());
+    outTexture.data.clear();
+    for (const Image &image : levels)
+    {
+        if (format == kFormatRGBA8888)
+            outTexture.data.insert(outTexture.data.end(), image.pixels.begin(), image.pixels.end());
+        else
+            appendBlocks(image, format, outTexture.data);
+    }
+
+    return true;
+}
+
+} // namespace
+
+bool convertTexture(const std::string &filename, const TextureOptions &options,
+                    TextureData &outTexture)
+{
+    std::string cachePath;
+    if (!options.cacheDir.empty())
+    {
+        std::string key;
+        if (!computeCacheKey(filename, options, key))
+            return false;
+
+        cachePath = options.cacheDir + "/" + key + ".tex";
+        if (readCacheFile(cachePath, outTexture))
+        {
+            printf("read texture %s (cached)\n", filename.c_str());
+            return true;
+        }
+    }
+
+    printf("read texture %s\n", filename.c_str());
+    if (!buildTexture(filename, options, outTexture))
+        return false;
+
+    if (!cachePath.empty())
+        writeCacheFile(cachePath, outTexture);
+
+    return true;
+}
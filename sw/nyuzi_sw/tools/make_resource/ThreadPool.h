@@ -0,0 +1,112 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// A fixed set of worker threads that run batches of independent jobs.
+// run calls job(0) through job(numJobs - 1), each on whichever thread is
+// free next, and returns when all have finished. The calling thread also
+// runs jobs.
+//
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int numThreads)
+    {
+        for (int i = 1; i < numThreads; i++)
+            fThreads.emplace_back(&ThreadPool::workerLoop, this);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            fExiting = true;
+        }
+
+        fWorkAvailable.notify_all();
+        for (std::thread &thread : fThreads)
+            thread.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void run(int numJobs, const std::function<void(int)> &job)
+    {
+        std::unique_lock<std::mutex> lock(fMutex);
+        fJob = &job;
+        fNumJobs = numJobs;
+        fNextJob = 0;
+        fFinishedJobs = 0;
+        fWorkAvailable.notify_all();
+        runJobs(lock);
+        fAllFinished.wait(lock, [this] { return fFinishedJobs == fNumJobs; });
+        fJob = nullptr;
+    }
+
+private:
+    // Run jobs from the current batch until none are left. Called with
+    // the mutex held.
+    void runJobs(std::unique_lock<std::mutex> &lock)
+    {
+        while (fJob != nullptr && fNextJob < fNumJobs)
+        {
+            const int jobIndex = fNextJob++;
+            const std::function<void(int)> *job = fJob;
+            lock.unlock();
+            (*job)(jobIndex);
+            lock.lock();
+            if (++fFinishedJobs == fNumJobs)
+                fAllFinished.notify_all();
+        }
+    }
+
+    void workerLoop()
+    {
+        std::unique_lock<std::mutex> lock(fMutex);
+        while (true)
+        {
+            fWorkAvailable.wait(lock, [this]
+            {
+                return fExiting || (fJob != nullptr && fNextJob < fNumJobs);
+            });
+
+            if (fExiting)
+                return;
+
+            runJobs(lock);
+        }
+    }
+
+    std::vector<std::thread> fThreads;
+    std::mutex fMutex;
+    std::condition_variable fWorkAvailable;
+    std::condition_variable fAllFinished;
+    const std::function<void(int)> *fJob = nullptr;
+    int fNumJobs = 0;
+    int fNextJob = 0;
+    int fFinishedJobs = 0;
+    bool fExiting = false;
+};
@@ -0,0 +1,500 @@
+//
+// Copyright 2011-2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Read a Wavefront .OBJ file and convert it into the resource file format
+// that scene_viewer loads. This is a faster replacement for
+// make_resource_file.py that also reorders geometry for locality: meshes
+// are split into spatially compact clusters, and triangles and vertices are
+// reordered so neighbors in the buffers are neighbors in the model.
+// Textures are decoded and converted in parallel.
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "Mesh.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+
+namespace
+{
+
+// These must match the structures and flags in scene_viewer/SceneView.h
+const uint32_t FILE_PLANAR_VERTICES = 1;
+const uint32_t MESH_INDEX16 = 1;
+const uint32_t MESH_QUANTIZED = 2;
+
+struct FileHeader
+{
+    uint32_t fileSize;
+    uint32_t numTextures;
+    uint32_t numMeshes;
+    uint32_t flags;
+};
+
+struct TextureEntry
+{
+    uint32_t offset;
+    uint16_t mipLevels;
+    uint16_t format;
+    uint16_t width;
+    uint16_t height;
+};
+
+struct MeshEntry
+{
+    uint32_t offset;
+    uint32_t textureId;
+    uint32_t numVertices;
+    uint32_t numIndices;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint32_t flags;
+};
+
+// With --quantize, texture coordinates are stored as half floats if they
+// are all within this range, which keeps the error below 1/1024.
+const float kHalfFloatUvLimit = 2.0f;
+
+// Clusters are small enough that most are entirely inside or outside the
+// view frustum, but large enough to fill the vector lanes when shading
+// vertices and setting up triangles.
+const int kDefaultClusterSize = 2048;
+
+bool planarVertices = false;
+bool quantize = false;
+TextureOptions textureOptions;
+
+void usage()
+{
+    printf("make_resource [options] <obj file>\n");
+    printf("  -o <file>              file to write (defaults to resource.bin)\n");
+    printf("  -j <n>                 number of threads to convert textures with\n");
+    printf("                         (defaults to the number of processors)\n");
+    printf("  --compress             store textures in BC1/BC3 block compressed format\n");
+    printf("  --tiled                store uncompressed textures in 4x4 blocks\n");
+    printf("  --cache-dir <dir>      reuse textures converted by earlier runs\n");
+    printf("  --planar               store each vertex attribute in a separate array\n");
+    printf("  --quantize             use 16-bit indices, normals, and texture coordinates\n");
+    printf("                         where possible\n");
+    printf("  --cluster-size <n>     split meshes into clusters of up to n triangles\n");
+    printf("                         (default %d, 0 to not split)\n", kDefaultClusterSize);
+    printf("  --no-optimize          keep meshes, triangles, and vertices in file order\n");
+}
+
+size_t align(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// IEEE half precision, rounding to nearest even.
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+    const int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent >= 31)
+        return sign | 0x7c00;	// Overflow, infinity
+
+    if (exponent <= 0)
+    {
+        // Denormal or zero
+        if (exponent < -10)
+            return sign;
+
+        mantissa |= 0x800000;
+        const int shift = 14 - exponent;
+        const uint32_t halfway = 1u << (shift - 1);
+        uint32_t result = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        if (remainder > halfway || (remainder == halfway && (result & 1)))
+            result++;
+
+        return sign | uint16_t(result);
+    }
+
+    uint32_t result = (uint32_t(exponent) << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1)))
+        result++;	// May carry into the exponent, which is correct
+
+    return sign | uint16_t(result);
+}
+
+int16_t floatToSnorm(float value)
+{
+    return int16_t(lrintf(fmaxf(-1.0f, fminf(1.0f, value)) * 32767.0f));
+}
+
+uint32_t meshFlags(const Mesh &mesh)
+{
+    if (!quantize)
+        return 0;
+
+    uint32_t flags = 0;
+    if (mesh.vertices.size() <= 0x10000)
+        flags |= MESH_INDEX16;
+
+    bool uvInRange = true;
+    for (const Vertex &vertex : mesh.vertices)
+    {
+        if (fabsf(vertex.attrs[3]) > kHalfFloatUvLimit
+                || fabsf(vertex.attrs[4]) > kHalfFloatUvLimit)
+        {
+            uvInRange = false;
+            break;
+        }
+    }
+
+    if (uvInRange)
+        flags |= MESH_QUANTIZED;
+
+    return flags;
+}
+
+template <typename T>
+void append(std::vector<uint8_t> &data, T value)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+// Position, texture coordinate, normal. Quantized meshes store half float
+// texture coordinates and signed normalized normals.
+void appendAttribute(std::vector<uint8_t> &data, const Vertex &vertex, int attrib,
+                     bool quantized)
+{
+    if (!quantized || attrib < 3)
+        append(data, vertex.attrs[attrib]);
+    else if (attrib < 5)
+        append(data, floatToHalf(vertex.attrs[attrib]));
+    else
+        append(data, floatToSnorm(vertex.attrs[attrib]));
+}
+
+int attributeSize(int attrib, bool quantized)
+{
+    return !quantized || attrib < 3 ? 4 : 2;
+}
+
+void appendMesh(std::vector<uint8_t> &data, const Mesh &mesh, uint32_t flags)
+{
+    const bool quantized = (flags & MESH_QUANTIZED) != 0;
+    if (planarVertices)
+    {
+        // Write each attribute as a separate array, padded to a multiple of
+        // 32 vertices.
+        const size_t pitch = align(mesh.vertices.size(), 32);
+        for (int attrib = 0; attrib < kAttrsPerVertex; attrib++)
+        {
+            for (const Vertex &vertex : mesh.vertices)
+                appendAttribute(data, vertex, attrib, quantized);
+
+            data.resize(data.size() + (pitch - mesh.vertices.size())
+                        * size_t(attributeSize(attrib, quantized)));
+        }
+    }
+    else
+    {
+        // Pad each vertex to a multiple of four bytes
+        for (const Vertex &vertex : mesh.vertices)
+        {
+            for (int attrib = 0; attrib < kAttrsPerVertex; attrib++)
+                appendAttribute(data, vertex, attrib, quantized);
+
+            data.resize(align(data.size(), 4));
+        }
+    }
+
+    for (uint32_t index : mesh.indices)
+    {
+        if (flags & MESH_INDEX16)
+            append(data, uint16_t(index));
+        else
+            append(data, index);
+    }
+
+    data.resize(align(data.size(), 4));
+}
+
+bool writeResourceFile(const char *filename, const Scene &scene,
+                       const std::vector<TextureData> &textures)
+{
+    const size_t numTextures = textures.size();
+    const size_t numMeshes = scene.meshes.size();
+    const size_t headerSize = sizeof(FileHeader) + numTextures * sizeof(TextureEntry)
+                              + numMeshes * sizeof(MeshEntry);
+    std::vector<uint8_t> data(headerSize);
+    std::vector<TextureEntry> textureEntries;
+    for (const TextureData &texture : textures)
+    {
+        // The viewer uses RGBA8888Tiled data in place, and reads each block
+        // with a vector load, which must be aligned to a cache line.
+        data.resize(align(data.size(), texture.format == kFormatRGBA8888Tiled ? 64 : 4));
+
+        TextureEntry entry;
+        entry.offset = uint32_t(data.size());
+        entry.mipLevels = uint16_t(texture.mipLevels);
+        entry.format = uint16_t(texture.format);
+        entry.width = uint16_t(texture.width);
+        entry.height = uint16_t(texture.height);
+        textureEntries.push_back(entry);
+        data.insert(data.end(), texture.data.begin(), texture.data.end());
+    }
+
+    std::vector<MeshEntry> meshEntries;
+    for (const Mesh &mesh : scene.meshes)
+    {
+        // Planar attribute arrays are read with block loads, which must be
+        // aligned to a cache line.
+        data.resize(align(data.size(), planarVertices ? 64 : 4));
+
+        MeshEntry entry;
+        entry.offset = uint32_t(data.size());
+        entry.textureId = uint32_t(mesh.textureId);
+        entry.numVertices = uint32_t(mesh.vertices.size());
+        entry.numIndices = uint32_t(mesh.indices.size());
+        for (int axis = 0; axis < 3; axis++)
+        {
+            entry.boundsMin[axis] = INFINITY;
+            entry.boundsMax[axis] = -INFINITY;
+        }
+
+        for (const Vertex &vertex : mesh.vertices)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                entry.boundsMin[axis] = fminf(entry.boundsMin[axis], vertex.attrs[axis]);
+                entry.boundsMax[axis] = fmaxf(entry.boundsMax[axis], vertex.attrs[axis]);
+            }
+        }
+
+        entry.flags = meshFlags(mesh);
+        meshEntries.push_back(entry);
+        appendMesh(data, mesh, entry.flags);
+    }
+
+    FileHeader header;
+    header.fileSize = uint32_t(data.size());
+    header.numTextures = uint32_t(numTextures);
+    header.numMeshes = uint32_t(numMeshes);
+    header.flags = planarVertices ? FILE_PLANAR_VERTICES : 0;
+    memcpy(data.data(), &header, sizeof(header));
+    if (numTextures > 0)
+    {
+        memcpy(data.data() + sizeof(FileHeader), textureEntries.data(),
+               numTextures * sizeof(TextureEntry));
+    }
+
+    if (numMeshes > 0)
+    {
+        memcpy(data.data() + sizeof(FileHeader) + numTextures * sizeof(TextureEntry),
+               meshEntries.data(), numMeshes * sizeof(MeshEntry));
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == nullptr)
+    {
+        perror("Couldn't write output file");
+        return false;
+    }
+
+    if (fwrite(data.data(), 1, data.size(), file) != data.size())
+    {
+        perror("error writing output file");
+        fclose(file);
+        return false;
+    }
+
+    fclose(file);
+    printf("wrote %s\n", filename);
+    return true;
+}
+
+void printStats(const Scene &scene)
+{
+    size_t totalTriangles = 0;
+    size_t totalVertices = 0;
+    float mins[3] = { INFINITY, INFINITY, INFINITY };
+    float maxs[3] = { -INFINITY, -INFINITY, -INFINITY };
+    for (const Mesh &mesh : scene.meshes)
+    {
+        totalTriangles += mesh.indices.size() / 3;
+        totalVertices += mesh.vertices.size();
+        for (const Vertex &vertex : mesh.vertices)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                mins[axis] = fminf(mins[axis], vertex.attrs[axis]);
+                maxs[axis] = fmaxf(maxs[axis], vertex.attrs[axis]);
+            }
+        }
+    }
+
+    printf("meshes %zu\n", scene.meshes.size());
+    printf("triangles %zu\n", totalTriangles);
+    printf("vertices %zu\n", totalVertices);
+    printf("scene bounds\n");
+    printf("  x %g %g\n", double(mins[0]), double(maxs[0]));
+    printf("  y %g %g\n", double(mins[1]), double(maxs[1]));
+    printf("  z %g %g\n", double(mins[2]), double(maxs[2]));
+}
+
+} // namespace
+
+int main(int argc, char * const argv[])
+{
+    enum
+    {
+        kOptCompress = 256,
+        kOptTiled,
+        kOptCacheDir,
+        kOptPlanar,
+        kOptQuantize,
+        kOptClusterSize,
+        kOptNoOptimize
+    };
+
+    static const struct option kLongOptions[] =
+    {
+        { "compress", no_argument, nullptr, kOptCompress },
+        { "tiled", no_argument, nullptr, kOptTiled },
+        { "cache-dir", required_argument, nullptr, kOptCacheDir },
+        { "planar", no_argument, nullptr, kOptPlanar },
+        { "quantize", no_argument, nullptr, kOptQuantize },
+        { "cluster-size", required_argument, nullptr, kOptClusterSize },
+        { "no-optimize", no_argument, nullptr, kOptNoOptimize },
+        { nullptr, 0, nullptr, 0 }
+    };
+
+    const char *outputFilename = "resource.bin";
+    int clusterSize = kDefaultClusterSize;
+    bool optimize = true;
+    int numThreads = int(std::thread::hardware_concurrency());
+    int c;
+    while ((c = getopt_long(argc, argv, "o:j:?", kLongOptions, nullptr)) != -1)
+    {
+        switch (c)
+        {
+            case 'o':
+                outputFilename = optarg;
+                break;
+
+            case 'j':
+                numThreads = atoi(optarg);
+                break;
+
+            case kOptCompress:
+                textureOptions.compress = true;
+                break;
+
+            case kOptTiled:
+                textureOptions.tiled = true;
+                break;
+
+            case kOptCacheDir:
+                textureOptions.cacheDir = optarg;
+                break;
+
+            case kOptPlanar:
+                planarVertices = true;
+                break;
+
+            case kOptQuantize:
+                quantize = true;
+                break;
+
+            case kOptClusterSize:
+                clusterSize = atoi(optarg);
+                break;
+
+            case kOptNoOptimize:
+                optimize = false;
+                break;
+
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Missing OBJ file\n");
+        usage();
+        return 1;
+    }
+
+    Scene scene;
+    if (!readObjFile(argv[optind], scene))
+        return 1;
+
+    if (!textureOptions.cacheDir.empty() && mkdir(textureOptions.cacheDir.c_str(), 0777) != 0
+            && errno != EEXIST)
+    {
+        perror("couldn't create cache directory");
+        return 1;
+    }
+
+    // Each texture is independent, so convert them in parallel.
+    std::vector<TextureData> textures(scene.textureFiles.size());
+    std::vector<char> converted(scene.textureFiles.size());
+    ThreadPool pool(std::max(numThreads, 1));
+    pool.run(int(textures.size()), [&](int index)
+    {
+        converted[size_t(index)] = convertTexture(scene.textureFiles[size_t(index)],
+                                   textureOptions, textures[size_t(index)]);
+    });
+
+    for (char success : converted)
+    {
+        if (!success)
+            return 1;
+    }
+
+    if (optimize)
+    {
+        std::vector<Mesh> meshes;
+        for (const Mesh &mesh : scene.meshes)
+        {
+            if (clusterSize > 0)
+                splitMesh(mesh, clusterSize, meshes);
+            else
+                meshes.push_back(mesh);
+        }
+
+        for (Mesh &mesh : meshes)
+        {
+            optimizeTriangleOrder(mesh);
+            optimizeVertexOrder(mesh);
+        }
+
+        scene.meshes.swap(meshes);
+    }
+
+    printStats(scene);
+    if (!writeResourceFile(outputFilename, scene, textures))
+        return 1;
+
+    return 0;
+}